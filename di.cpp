@@ -6,24 +6,37 @@
 #include "di.h"
 #endif
 
+#include <algorithm>
+#include <functional>
 #include <map>
+#include <memory>
+#include <sstream>
 
 namespace di
 {
   namespace internal
   {
     DI_INLINE void* BeanBase::convertTo(const InstanceBase& typeToConvertTo) const /* throw (DependencyInjectionException) */
+    {
+      if (prototypeScope)
+        DI_FAIL(NULL, Status::notInjectable, toString(), typeToConvertTo.toString(), "\"%s\" is a prototype and must be acquired from the context rather than injected.", toString().c_str());
+
+      void* ret = decorators ? decorated(typeToConvertTo) : NULL;
+      return ret ? ret : convertUndecorated(typeToConvertTo);
+    }
+
+    DI_INLINE void* BeanBase::convertUndecorated(const InstanceBase& typeToConvertTo) const /* throw (DependencyInjectionException) */
     {
       const void* obj = getConcrete();
-      for(std::vector<InstanceConverterBase*>::const_iterator it = isAlsoTheseInstances.begin(); it != isAlsoTheseInstances.end(); it++)
+      for(Converters::const_iterator it = isAlsoTheseInstances.begin(); it != isAlsoTheseInstances.end(); it++)
       {
-        InstanceConverterBase* typeConverter = (*it);
+        const InstanceConverterBase* typeConverter = (*it);
 
         if (typeConverter->isInstanceToConvertTo(typeToConvertTo))
         {
-          void* ret = ((InstanceConverterBase*)typeConverter)->doConvert((void*)obj);
+          void* ret = typeConverter->doConvert((void*)obj);
           if (ret == NULL)
-            throw DependencyInjectionException("Failed to convert a \"%s\" to a \"%s\" using a dynamic_cast for ", typeConverter->toString().c_str(), type.getInstanceInfo().name());
+            DI_FAIL(NULL, Status::conversionFailed, toString(), typeToConvertTo.toString(), "Failed to convert a \"%s\" to a \"%s\" using a dynamic_cast for ", typeConverter->toString().c_str(), type->name());
           return ret;
         }
       }
@@ -33,9 +46,9 @@ namespace di
 
     DI_INLINE bool BeanBase::canConvertTo(const internal::InstanceBase& typeToConvertTo) const
     {
-      for(std::vector<InstanceConverterBase*>::const_iterator it = isAlsoTheseInstances.begin(); it != isAlsoTheseInstances.end(); it++)
+      for(Converters::const_iterator it = isAlsoTheseInstances.begin(); it != isAlsoTheseInstances.end(); it++)
       {
-        InstanceConverterBase* typeConverter = (*it);
+        const InstanceConverterBase* typeConverter = (*it);
 
         if (typeConverter->isInstanceToConvertTo(typeToConvertTo))
           return true;
@@ -43,79 +56,186 @@ namespace di
 
       return false;
     }
-  }
 
-  DI_INLINE internal::BeanBase* Context::find(const internal::InstanceBase& typeInfo, const char* id, bool exact)
-  {
-    for(std::vector<internal::BeanBase*>::iterator it = instances.begin(); it != instances.end(); it++)
+    DI_INLINE size_t BeanBase::footprint() const
     {
-      internal::BeanBase* instance = (*it);
+      size_t ret = isAlsoTheseInstances.heapBytes() + requirements.heapBytes();
+      if (factory)
+        ret += factory->footprint();
+      for (Requirements::const_iterator it = requirements.begin(); it != requirements.end(); it++)
+        ret += (*it)->footprint();
+      for (const DecoratorBase* decorator = decorators; decorator != NULL; decorator = decorator->next)
+        ret += decorator->footprint();
+      return ret;
+    }
+
+    DI_INLINE void BeanBase::addDecorator(DecoratorBase* decorator)
+    {
+      DecoratorBase** last = &decorators;
+      while (*last != NULL)
+        last = &(*last)->next;
+      *last = decorator;
+    }
+
+    DI_INLINE void* BeanBase::decorated(const InstanceBase& as) const
+    {
+      void* ret = NULL;
+      for (const DecoratorBase* decorator = decorators; decorator != NULL; decorator = decorator->next)
+        if (decorator->instance != NULL && decorator->sameInstance(as))
+          ret = decorator->instance;
+      return ret;
+    }
+
+    DI_INLINE void BeanBase::createDecorators() /* throw (DependencyInjectionException) */
+    {
+      for (DecoratorBase* decorator = decorators; decorator != NULL; decorator = decorator->next)
+      {
+        // the first wraps the instance and the rest wrap the one before
+        void* inner = decorated(*decorator);
+        if (inner == NULL)
+        {
+          inner = convertUndecorated(*decorator);
+          DI_PROPAGATE();
+        }
+        decorator->instance = decorator->create(inner);
+      }
+    }
 
-      if (((exact && instance->type.getInstanceInfo() == typeInfo.getInstanceInfo()) ||
-           (!exact && instance->canConvertTo(typeInfo))) && 
-          (id == NULL || instance->id == id))
-        return instance;
+    DI_INLINE void BeanBase::destroyDecorators()
+    {
+      // the outermost go first since they may still be using the ones they wrap
+      std::vector<DecoratorBase*> created;
+      for (DecoratorBase* decorator = decorators; decorator != NULL; decorator = decorator->next)
+        if (decorator->instance != NULL)
+          created.push_back(decorator);
+      for (std::vector<DecoratorBase*>::reverse_iterator it = created.rbegin(); it != created.rend(); it++)
+      {
+        (*it)->destroy((*it)->instance);
+        (*it)->instance = NULL;
+      }
     }
-    return NULL;
   }
 
-  DI_INLINE void Context::findAll(std::vector<internal::BeanBase*>& ret, const internal::InstanceBase& typeInfo, const char* id, bool exact)
+  namespace internal
   {
-    for(std::vector<internal::BeanBase*>::iterator it = instances.begin(); it != instances.end(); it++)
+    struct FindFirst
     {
-      internal::BeanBase* instance = (*it);
+      BeanBase* found;
+      inline FindFirst() : found(NULL) {}
+      inline void reserve(size_t) {}
+      inline bool operator()(BeanBase* bean) { found = bean; return false; }
+    };
 
-      if (((exact && instance->type.getInstanceInfo() == typeInfo.getInstanceInfo()) ||
-           (!exact && instance->canConvertTo(typeInfo))) && 
-          (id == NULL || instance->id == id))
-        ret.push_back(instance);
-    }
+    struct FindAll
+    {
+      std::vector<BeanBase*>& found;
+      inline FindAll(std::vector<BeanBase*>& f) : found(f) {}
+      inline void reserve(size_t count) { found.reserve(found.size() + count); }
+      inline bool operator()(BeanBase* bean) { found.push_back(bean); return true; }
+    };
+  }
+
+  DI_INLINE void Context::install(Module& module) /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    if (module.empty())
+      return;
+
+    // what this thread declared first comes first
+    if (staging.any())
+      publishStaged(false);
+    registry.addAll(&module.beans[0], module.beans.size());
+    DI_PROPAGATE();
+    module.beans.clear();
+  }
+
+  DI_INLINE void Context::publishStaged(bool all)
+  {
+    std::vector<internal::BeanBase*> staged;
+    if (all)
+      staging.takeAll(staged);
+    else
+      staging.takeOwn(staged);
+    if (!staged.empty())
+      registry.append(&staged[0], staged.size());
+  }
+
+  DI_INLINE internal::BeanBase* Context::find(const internal::InstanceBase& typeInfo, const Id& id, bool exact)
+  {
+    counters.count(internal::Counters::finds);
+    internal::FindFirst visitor;
+    visitAll(visitor,typeInfo,id.symbol(),exact);
+    return visitor.found;
+  }
+
+  DI_INLINE void Context::findAll(std::vector<internal::BeanBase*>& ret, const internal::InstanceBase& typeInfo, const Id& id, bool exact)
+  {
+    counters.count(internal::Counters::findAlls);
+    internal::FindAll visitor(ret);
+    visitAll(visitor,typeInfo,id.symbol(),exact);
   }
 
   DI_INLINE void Context::resetBeans()
   {
     internal::BeanBase* instance;
-    for(std::vector<internal::BeanBase*>::iterator it = instances.begin(); it != instances.end(); it++)
+    internal::Registry::View beans = registry.view();
+    for(internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
     {
       // since this results in the instance destructor being called ... in case some moron 
       // throws from the destructor, we don't want to stop deleting.
-      try 
+      DI_TRY 
       { 
         instance = (*it);
         instance->reset();
+
+        std::lock_guard<std::mutex> lock(readyLock);
+        instance->ready = false;
       }
-      catch (DependencyInjectionException& die) { throw die; }
-      catch (...) 
+      DI_CATCH(DependencyInjectionException&) { DI_RETHROW; }
+      DI_CATCH_ALL
       { 
         // this prints a message to the log as long as there is a logger set in the exception
         DependencyInjectionException ex("Exception detected in the destructor of the instance for \"%s.\"",instance->toString().c_str());
       }
     }
 
+    // nothing restored from the checkpoint is left to use it.
+    restoredFrom.close();
     curPhase = stopped;
   }
 
   DI_INLINE void Context::stop() /* throw (DependencyInjectionException) */
   {
+    // if there's a start in flight, let it finish first.
+    DI_CLEAR_FAILURE();
+    waitForStart();
+    DI_PROPAGATE();
+    joinStarter();
+
+    // stopForExit left the rest of the instances for the process exit.
+    if (exited)
+      return;
+
     if (! isStopped())
     {
       internal::BeanBase* instance;
       // pre destroy step
-      for(std::vector<internal::BeanBase*>::iterator it = instances.begin(); it != instances.end(); it++)
+      internal::Registry::View beans = registry.view();
+      for(internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
       {
         instance = (*it);
-        try
+        DI_TRY
         {
           instance->doPreDestroy();
         }
-        catch (DependencyInjectionException& die) { throw die; }
-        catch (...)
+        DI_CATCH(DependencyInjectionException&) { DI_RETHROW; }
+        DI_CATCH_ALL
         {
           // hum .... what to do? c++ sucks here in that I cannot get a handle to the 
           // original exception. ... I can either log and rethrow or I can throw another
           // known exception. I wish I could wrap and throw.
           resetBeans();
-          throw DependencyInjectionException("Unknown exception intercepted while executing PreDestroy phase on \"%s.\"", instance->toString().c_str());
+          DI_FAIL(, Status::callbackFailed, instance->toString(), std::string(), "Unknown exception intercepted while executing PreDestroy phase on \"%s.\"", instance->toString().c_str());
         }
       }
 
@@ -125,97 +245,1123 @@ namespace di
     resetBeans();
   }
 
+  DI_INLINE void Context::stopForExit() /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    waitForStart();
+    DI_PROPAGATE();
+    joinStarter();
+
+    // every instance with side effects is cleaned up even if another's preDestroy 
+    //  fails since this is it's last chance. The first failure is reported after.
+    internal::BeanBase* failedOn = NULL;
+    std::exception_ptr failure;
+    if (!isStopped())
+    {
+      // the rest aren't touched at all.
+      internal::Registry::View beans = registry.view();
+      const unsigned char* scopes = beans.scopes();
+      for(size_t i = 0; i < beans.size(); i++)
+        if (scopes[i] & internal::Registry::sideEffects)
+        {
+          internal::BeanBase* instance = beans[i];
+          DI_TRY { instance->doPreDestroy(); }
+          DI_CATCH_ALL
+          {
+            if (failedOn == NULL)
+            {
+              failedOn = instance;
+              failure = std::current_exception();
+            }
+          }
+        }
+
+      for(size_t i = 0; i < beans.size(); i++)
+        if (scopes[i] & internal::Registry::sideEffects)
+        {
+          internal::BeanBase* instance = beans[i];
+          DI_TRY { instance->reset(); }
+          DI_CATCH_ALL
+          { 
+            DependencyInjectionException ex("Exception detected in the destructor of the instance for \"%s.\"",instance->toString().c_str());
+          }
+        }
+    }
+
+    exited = true;
+    curPhase = stopped;
+
+    // without exceptions nothing can fail here.
+    if (failedOn != NULL)
+    {
+      DI_TRY { std::rethrow_exception(failure); }
+      DI_CATCH(DependencyInjectionException&) { DI_RETHROW; }
+      DI_CATCH_ALL
+      {
+        DI_FAIL(, Status::callbackFailed, failedOn->toString(), std::string(), "Unknown exception intercepted while executing PreDestroy phase on \"%s.\"", failedOn->toString().c_str());
+      }
+    }
+  }
+
+  DI_INLINE void Context::compact() /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    if (!isStarted())
+      DI_FAIL(, Status::wrongPhase, std::string(), std::string(), "compact needs the di::Context to be started.");
+
+    // lazy instances are only ever instantiated under this.
+    std::lock_guard<std::recursive_mutex> guard(lazyLock);
+    internal::Registry::View beans = registry.view();
+    const unsigned char* scopes = beans.scopes();
+    for (size_t i = 0; i < beans.size(); i++)
+    {
+      if (scopes[i] & internal::Registry::prototype)
+        continue;
+      internal::BeanBase* bean = beans[i];
+      if (bean->instantiated() && !bean->isSwappable() && !bean->isDeferred() && !bean->isCheckpointed())
+        bean->compact();
+    }
+    compacted = true;
+  }
+
   DI_INLINE void Context::clear()
   {
-    try { stop(); } catch (DependencyInjectionException& ex) {}
-    for(std::vector<internal::BeanBase*>::iterator it = instances.begin(); it != instances.end(); it++)
-      delete (*it);
-    instances.clear();
+    if (exited)
+    {
+      // after stopForExit everything is left where it is.
+      registry.clear(false);
+      return;
+    }
+
+    DI_TRY { stop(); } DI_CATCH(DependencyInjectionException&) {}
+    DI_CLEAR_FAILURE();
+    // this deletes the Beans once no reader can still see them.
+    publishStaged(true);
+    registry.clear();
+    compacted = false;
     curPhase = initial;
   }
 
   DI_INLINE void Context::start() /* throw (DependencyInjectionException) */
   {
-    if (isStarted())
-      throw DependencyInjectionException("Called start for a second time on a di::Context.");
+    DI_CLEAR_FAILURE();
+    beginStart();
+    DI_PROPAGATE();
+    runStart();
+  }
 
-    // First instantiate
-    // This loop is stupid. Instead the order of instantiation ought to be determined.
-    //  but for now this works.
-    internal::BeanBase* instance;
-    try
+  DI_INLINE std::future<void> Context::startAsync() /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    beginStart();
+    DI_PROPAGATE(std::future<void>());
+
+    // publish what every thread declared before returning so that waitFor, on any
+    //  thread, finds it rather than racing the starter to it.
+    publishStaged(true);
+
+    std::shared_ptr<std::promise<void> > promise(new std::promise<void>);
+    std::future<void> ret = promise->get_future();
+    starter = std::thread([this, promise]()
+    {
+      // without exceptions the future just completes. Use tryStart to find out why
+      //  a start failed.
+      DI_TRY
+      {
+        runStart();
+        promise->set_value();
+      }
+      DI_CATCH_ALL
+      {
+        promise->set_exception(std::current_exception());
+      }
+    });
+    return ret;
+  }
+
+  DI_INLINE Context::Progress Context::progress()
+  {
+    Progress ret;
+    ret.total = isStarting() || isStarted() ? numToStart.load() : (unsigned int)registry.view().size();
+    ret.instantiated = numInstantiated;
+    ret.wired = numWired;
+    ret.postConstructed = numPostConstructed;
+    ret.warmedUp = numWarmedUp;
+    return ret;
+  }
+
+  DI_INLINE Context::Stats Context::stats()
+  {
+    Stats ret;
+    ret.enabled = counters.isEnabled();
+    ret.finds = counters.total(internal::Counters::finds);
+    ret.findAlls = counters.total(internal::Counters::findAlls);
+    ret.candidatesScanned = counters.total(internal::Counters::candidatesScanned);
+    ret.conversions = counters.total(internal::Counters::conversions);
+    ret.lazyCreated = counters.total(internal::Counters::lazyCreated);
+    ret.acquired = counters.total(internal::Counters::acquired);
+    ret.progress = progress();
+    ret.declared = ret.progress.total;
+    return ret;
+  }
+
+  DI_INLINE Context::DependencyGraph Context::dependencyGraph()
+  {
+    if (staging.any())
+      publishStaged(false);
+    DependencyGraph ret;
+    internal::Registry::View beans = registry.view();
+
+    ret.nodes.resize(beans.size());
+    for (size_t i = 0; i < beans.size(); i++)
+    {
+      internal::BeanBase* bean = beans[i];
+      DependencyGraph::Node& node = ret.nodes[i];
+      node.name = bean->toString();
+      for (internal::BeanBase::Converters::iterator it = bean->isAlsoTheseInstances.begin(); it != bean->isAlsoTheseInstances.end(); it++)
+        node.provides.push_back((*it)->getInstanceInfo().name());
+      node.prototype = bean->isPrototype();
+      node.lazy = bean->isLazy();
+      node.cost = std::chrono::nanoseconds(0);
+      if (lastTimings.size() == beans.size())
+        node.cost = lastTimings[i].instantiate + lastTimings[i].postConstruct;
+    }
+    dependencyEdges(beans, ret.edges);
+
+    ret.findCriticalPath();
+    return ret;
+  }
+
+  DI_INLINE void Context::dependencyEdges(const internal::Registry::View& beans, std::vector<DependencyGraph::Edge>& ret)
+  {
+    std::unordered_map<internal::BeanBase*, size_t> positions;
+    for (size_t i = 0; i < beans.size(); i++)
+      positions[beans[i]] = i;
+
+    for (size_t i = 0; i < beans.size(); i++)
+    {
+      internal::Dependencies dependencies;
+      beans[i]->dependencies(dependencies);
+
+      for (internal::Dependencies::iterator dit = dependencies.begin(); dit != dependencies.end(); dit++)
+      {
+        std::vector<internal::BeanBase*> found;
+        internal::FindAll visitor(found);
+        visitAll(visitor,*dit,dit->getId(),false);
+        for (std::vector<internal::BeanBase*>::iterator fit = found.begin(); fit != found.end(); fit++)
+        {
+          DependencyGraph::Edge edge;
+          edge.from = i;
+          edge.to = positions[*fit];
+          edge.kind = (DependencyGraph::Edge::Kind)dit->kind;
+          edge.required = dit->toString();
+          ret.push_back(edge);
+        }
+      }
+    }
+  }
+
+  namespace internal
+  {
+    /**
+     * The longest (by cost) path through a graph's dependencies starting at each
+     *  node. Memoized depth first search, on a stack of it's own so that a long 
+     *  chain of dependencies can't overflow the thread's.
+     */
+    struct LongestPaths
     {
-      std::vector<internal::BeanBase*> workingList;
-      workingList = instances;
+      enum State { unvisited = 0, visiting, done };
+
+      const Context::DependencyGraph& graph;
+      std::vector<std::vector<size_t> > dependsOn;
+      std::vector<State> state;
+      std::vector<std::chrono::nanoseconds> cost; // of the path starting at each node
+      std::vector<size_t> next; // the next node on that path, or the node itself at the end
+
+      inline LongestPaths(const Context::DependencyGraph& g) : graph(g), dependsOn(g.nodes.size()), 
+        state(g.nodes.size(), unvisited), cost(g.nodes.size()), next(g.nodes.size())
+      {
+        for (std::vector<Context::DependencyGraph::Edge>::const_iterator it = g.edges.begin(); it != g.edges.end(); it++)
+          if (it->kind != Context::DependencyGraph::Edge::provider)
+            dependsOn[it->from].push_back(it->to);
+      }
+
+      inline void enter(size_t node, std::vector<std::pair<size_t, size_t> >& stack)
+      {
+        state[node] = visiting;
+        cost[node] = graph.nodes[node].cost;
+        next[node] = node;
+        stack.push_back(std::make_pair(node, (size_t)0));
+      }
+
+      inline void visit(size_t root)
+      {
+        // each node being visited and which of it's dependencies it's up to
+        std::vector<std::pair<size_t, size_t> > stack;
+        enter(root, stack);
+        while (!stack.empty())
+        {
+          size_t node = stack.back().first;
+          size_t edge = stack.back().second;
+          if (edge == dependsOn[node].size())
+          {
+            state[node] = done;
+            stack.pop_back();
+            continue;
+          }
+
+          size_t dep = dependsOn[node][edge];
+          if (state[dep] == unvisited)
+          {
+            // back to this same edge once it's done
+            enter(dep, stack);
+            continue;
+          }
+          // an edge back to a node that's still being visited closes a cycle
+          if (state[dep] == done && graph.nodes[node].cost + cost[dep] > cost[node])
+          {
+            cost[node] = graph.nodes[node].cost + cost[dep];
+            next[node] = dep;
+          }
+          stack.back().second++;
+        }
+      }
+    };
+  }
+
+  DI_INLINE void Context::DependencyGraph::findCriticalPath()
+  {
+    criticalPath.clear();
+    criticalPathCost = std::chrono::nanoseconds(0);
+    if (nodes.size() == 0)
+      return;
+
+    internal::LongestPaths paths(*this);
+    size_t start = 0;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+      if (paths.state[i] == internal::LongestPaths::unvisited)
+        paths.visit(i);
+      if (paths.cost[i] > paths.cost[start])
+        start = i;
+    }
+
+    // the path runs from the dependent to what it depends on so it's reversed to
+    //  be in the order things need to be constructed.
+    for (size_t node = start; ; node = paths.next[node])
+    {
+      criticalPath.push_back(node);
+      if (paths.next[node] == node)
+        break;
+    }
+    std::reverse(criticalPath.begin(), criticalPath.end());
+    criticalPathCost = paths.cost[start];
+  }
+
+  namespace internal
+  {
+    inline std::string quote(const std::string& str)
+    {
+      std::string ret("\"");
+      for (std::string::const_iterator it = str.begin(); it != str.end(); it++)
+      {
+        if (*it == '"' || *it == '\\')
+          ret += '\\';
+        if ((unsigned char)(*it) < 0x20)
+          ret += ' ';
+        else
+          ret += *it;
+      }
+      return ret + "\"";
+    }
+
+    static const char* const edgeKinds[] = { "constructor", "setter", "all", "provider", "replicas", "swappable" };
+  }
+
+  DI_INLINE std::string Context::DependencyGraph::toDot() const
+  {
+    std::vector<bool> critical(nodes.size(), false);
+    for (std::vector<size_t>::const_iterator it = criticalPath.begin(); it != criticalPath.end(); it++)
+      critical[*it] = true;
+
+    std::ostringstream out;
+    out << "digraph di {\n";
+    for (size_t i = 0; i < nodes.size(); i++)
+      out << "  n" << i << " [label=" << internal::quote(nodes[i].name) << 
+        (nodes[i].prototype ? ", shape=box" : "") << (nodes[i].lazy ? ", style=dashed" : "") <<
+        (critical[i] ? ", penwidth=3" : "") << "];\n";
+    for (std::vector<Edge>::const_iterator it = edges.begin(); it != edges.end(); it++)
+      out << "  n" << it->from << " -> n" << it->to << " [label=" << internal::edgeKinds[it->kind] << 
+        (it->kind == Edge::provider ? ", style=dotted" : "") << "];\n";
+    out << "}\n";
+    return out.str();
+  }
+
+  DI_INLINE std::string Context::DependencyGraph::toJson() const
+  {
+    std::ostringstream out;
+    out << "{\"nodes\":[";
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+      const Node& node = nodes[i];
+      out << (i ? "," : "") << "{\"name\":" << internal::quote(node.name) << ",\"provides\":[";
+      for (size_t p = 0; p < node.provides.size(); p++)
+        out << (p ? "," : "") << internal::quote(node.provides[p]);
+      out << "],\"prototype\":" << (node.prototype ? "true" : "false") << ",\"lazy\":" << (node.lazy ? "true" : "false") <<
+        ",\"costNanos\":" << (long long)node.cost.count() << "}";
+    }
+    out << "],\"edges\":[";
+    for (size_t i = 0; i < edges.size(); i++)
+      out << (i ? "," : "") << "{\"from\":" << edges[i].from << ",\"to\":" << edges[i].to << ",\"kind\":\"" << 
+        internal::edgeKinds[edges[i].kind] << "\",\"required\":" << internal::quote(edges[i].required) << "}";
+    out << "],\"criticalPath\":[";
+    for (size_t i = 0; i < criticalPath.size(); i++)
+      out << (i ? "," : "") << criticalPath[i];
+    out << "],\"criticalPathCostNanos\":" << (long long)criticalPathCost.count() << "}";
+    return out.str();
+  }
+
+  DI_INLINE Context::MemoryReport Context::memoryReport()
+  {
+    if (staging.any())
+      publishStaged(false);
+    MemoryReport ret;
+    ret.beans = 0;
+    ret.instances = 0;
+    ret.metadataBytes = 0;
+    ret.instanceBytes = 0;
+    ret.registryBytes = registry.footprint();
+
+    internal::Registry::View beans = registry.view();
+    for(internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
+    {
+      internal::BeanBase* instance = (*it);
+      ret.beans++;
+      ret.metadataBytes += instance->footprint();
+      if (instance->getConcrete() != NULL)
+      {
+        ret.instances++;
+        ret.instanceBytes += instance->instanceSize();
+      }
+    }
+    return ret;
+  }
+
+  DI_INLINE bool Context::isWarmUpCancelled()
+  {
+    return warmUpCancelled || 
+      (warmUpBudget.count() > 0 && std::chrono::steady_clock::now() >= warmUpDeadline);
+  }
+
+  namespace internal
+  {
+    /**
+     * Orders Beans (by their position) so that those at the head of the longest 
+     *  chain of warm ups, through what depends on them, go first.
+     */
+    struct LongestWarmUpFirst
+    {
+      const std::vector<std::chrono::nanoseconds>* cost;
+      inline bool operator()(size_t lhs, size_t rhs) const { return (*cost)[lhs] > (*cost)[rhs]; }
+    };
+  }
+
+  DI_INLINE void Context::doWarmUp(std::vector<internal::StartPlan::Step>& byBean)
+  {
+    std::vector<size_t> toWarm;
+    // prototypes and lazy instances are never warmed up so they aren't asked.
+    internal::Registry::View beans = registry.view();
+    const unsigned char* scopes = beans.scopes();
+    for(size_t i = 0; i < beans.size(); i++)
+      if ((scopes[i] & (internal::Registry::prototype | internal::Registry::lazy)) == 0 && beans[i]->hasWarmUp())
+        toWarm.push_back(i);
+
+    // what depends on an instance is only of use once it's warm, so the chains of
+    //  warm ups through dependents (the critical path of the graph turned around) 
+    //  are what the workers can't finish before. Those that head the longest are 
+    //  started first, costed by what each warm up took last time. Without a previous
+    //  plan these are all zero and the declared order is kept.
+    if (toWarm.size() > 1)
+    {
+      DependencyGraph dependents;
+      dependents.nodes.resize(beans.size());
+      for (size_t i = 0; i < beans.size(); i++)
+        dependents.nodes[i].cost = std::chrono::nanoseconds(0);
+      for (std::vector<size_t>::iterator it = toWarm.begin(); it != toWarm.end(); it++)
+        dependents.nodes[*it].cost = byBean[*it].warmUp;
+      dependencyEdges(beans, dependents.edges);
+      for (std::vector<DependencyGraph::Edge>::iterator it = dependents.edges.begin(); it != dependents.edges.end(); it++)
+        std::swap(it->from, it->to);
+
+      internal::LongestPaths paths(dependents);
+      for (size_t i = 0; i < beans.size(); i++)
+        if (paths.state[i] == internal::LongestPaths::unvisited)
+          paths.visit(i);
+
+      internal::LongestWarmUpFirst longestFirst = { &paths.cost };
+      std::stable_sort(toWarm.begin(), toWarm.end(), longestFirst);
+    }
+
+    warmUpResults.clear();
+    warmUpResults.resize(toWarm.size());
+    if (toWarm.size() == 0)
+      return;
+
+    warmUpDeadline = std::chrono::steady_clock::now() + warmUpBudget;
+
+    // each worker claims the next instance to warm up. Results are written to
+    //  the slot for that instance so the workers never share anything else.
+    std::atomic<size_t> next(0);
+    std::function<void ()> worker = [this, &beans, &toWarm, &next]()
+    {
+      Starting starting(this);
+      for (size_t index = next++; index < toWarm.size(); index = next++)
+      {
+        internal::BeanBase* instance = beans[toWarm[index]];
+        WarmUpResult& result = warmUpResults[index];
+        result.bean = instance->toString();
+        result.duration = std::chrono::nanoseconds(0);
+        result.status = WarmUpResult::skipped;
+
+        if (isWarmUpCancelled())
+          continue;
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        DI_TRY
+        {
+          instance->doWarmUp();
+          result.status = WarmUpResult::completed;
+          numWarmedUp++;
+        }
+        DI_CATCH_ALL
+        {
+          // warming up is an optimization so a failure doesn't fail the start. This 
+          //  prints a message to the log.
+          DependencyInjectionException ex("Exception intercepted while executing the warmUp phase on \"%s.\"", instance->toString().c_str());
+          result.status = WarmUpResult::failed;
+        }
+        result.duration = std::chrono::steady_clock::now() - begin;
+      }
+    };
+
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (numThreads > toWarm.size())
+      numThreads = toWarm.size();
+
+    // this thread is one of the workers.
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; i++)
+      threads.push_back(std::thread(worker));
+    worker();
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++)
+      it->join();
+
+    // skipped ones keep what they took last time.
+    for (size_t i = 0; i < toWarm.size(); i++)
+      if (warmUpResults[i].status != WarmUpResult::skipped)
+        byBean[toWarm[i]].warmUp = warmUpResults[i].duration;
+  }
+
+  DI_INLINE void Context::beginStart() /* throw (DependencyInjectionException) */
+  {
+    if (isStarted() || isStarting())
+      DI_FAIL(, Status::wrongPhase, std::string(), std::string(), "Called start for a second time on a di::Context.");
+    if (exited)
+      DI_FAIL(, Status::wrongPhase, std::string(), std::string(), "Cannot start a di::Context after stopForExit.");
+    if (compacted)
+      DI_FAIL(, Status::wrongPhase, std::string(), std::string(), "Cannot start a di::Context that's been compacted without clearing it.");
+
+    // a previous startAsync may have finished but never been joined.
+    joinStarter();
+
+    {
+      std::lock_guard<std::mutex> lock(readyLock);
+      planned = false;
+    }
+    numToStart = (unsigned int)registry.view().size();
+    numInstantiated = 0;
+    numWired = 0;
+    numPostConstructed = 0;
+    numWarmedUp = 0;
+    warmUpCancelled = false;
+    curPhase = starting;
+  }
+
+  DI_INLINE void Context::finishStart(bool succeeded)
+  {
+    {
+      std::lock_guard<std::mutex> lock(readyLock);
+      if (succeeded)
+        curPhase = started;
+      else if (isStarting())
+        curPhase = stopped;
+    }
+    // wake up anyone in waitFor so they can see how it ended.
+    readyCondition.notify_all();
+  }
+
+  DI_INLINE void Context::markReady(internal::BeanBase* instance)
+  {
+    {
+      std::lock_guard<std::mutex> lock(readyLock);
+      instance->ready = true;
+      numPostConstructed++;
+    }
+    readyCondition.notify_all();
+  }
+
+  DI_INLINE void Context::waitForStart() /* throw (DependencyInjectionException) */
+  {
+    // the start would never finish since it's waiting for this callback.
+    if (startingOn() == this)
+      DI_FAIL(, Status::wrongPhase, std::string(), std::string(), "Cannot stop a di::Context from within it's own start.");
+
+    // there's no need to wait for it to finish warming up.
+    warmUpCancelled = true;
+    std::unique_lock<std::mutex> lock(readyLock);
+    while (isStarting())
+      readyCondition.wait(lock);
+  }
+
+  DI_INLINE void Context::joinStarter()
+  {
+    if (starter.joinable() && starter.get_id() != std::this_thread::get_id())
+      starter.join();
+  }
+
+  DI_INLINE void Context::instantiateLazy(internal::BeanBase* instance) /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    if (!isStarted() && !isStarting())
+      DI_FAIL(, Status::wrongPhase, instance->toString(), std::string(), "Cannot create the lazy \"%s\" unless the context is started.", instance->toString().c_str());
+
+    // creating one lazy instance can need another so this lock is recursive.
+    std::lock_guard<std::recursive_mutex> lock(lazyLock);
+    if (instance->instantiated())
+      return;
+
+    if (!instance->factory->dependenciesSatisfied(this))
+      DI_FAIL(, Status::unsatisfied, instance->toString(), unsatisfiedDependency(instance), "Cannot resolve constructor dependencies for \"%s\"", instance->toString().c_str());
+
+    DI_TRY
+    {
+      instance->instantiateBean(this);
+      internal::BeanBase::Requirements& requirements = instance->getRequirements();
+      for (internal::BeanBase::Requirements::iterator rit = requirements.begin(); rit != requirements.end() && !DI_FAILED(); rit++)
+        (*rit)->satisfy(instance,(void*)instance->getConcrete(),this);
+      if (DI_FAILED())
+      {
+        instance->reset();
+        return;
+      }
+      instance->doPostConstruct();
+      counters.count(internal::Counters::lazyCreated);
+    }
+    DI_CATCH(DependencyInjectionException&) 
+    {
+      instance->reset();
+      DI_RETHROW; 
+    }
+    DI_CATCH_ALL
+    {
+      instance->reset();
+      DI_FAIL(, Status::callbackFailed, instance->toString(), std::string(), "Unknown exception intercepted while creating the lazy \"%s.\"", instance->toString().c_str());
+    }
+  }
+
+  DI_INLINE internal::BeanBase* Context::waitForBean(const internal::InstanceBase& typeInfo, const Id& id) /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    internal::BeanBase* instance = find(typeInfo,id);
+    if (instance == NULL)
+      DI_FAIL(NULL, Status::notFound, typeInfo.toString(), std::string(), "Cannot wait for \"%s\" since the context has no such instance.", typeInfo.toString().c_str());
+
+    std::unique_lock<std::mutex> lock(readyLock);
+    if (!instance->ready && isStarting() && startingOn() == this)
+      DI_FAIL(NULL, Status::wrongPhase, instance->toString(), std::string(), "Cannot wait for \"%s\" from within the start that's creating it.", instance->toString().c_str());
+    while (!instance->ready && isStarting() && !(planned && !instance->createdByStart()))
+      readyCondition.wait(lock);
+
+    if (!instance->ready && planned && !instance->createdByStart() && (isStarting() || isStarted()))
+      DI_FAIL(NULL, Status::notCreated, instance->toString(), std::string(), "\"%s\" is lazy, dormant or left for onForked so the start won't create it.", instance->toString().c_str());
+    if (!instance->ready)
+      DI_FAIL(NULL, Status::wrongPhase, instance->toString(), std::string(), "The context isn't starting so \"%s\" will never be ready.", instance->toString().c_str());
+    return instance;
+  }
+
+  DI_INLINE std::string Context::unsatisfiedDependency(internal::BeanBase* instance)
+  {
+    internal::Dependencies dependencies;
+    instance->factory->dependencies(dependencies);
+    for (internal::Dependencies::iterator it = dependencies.begin(); it != dependencies.end(); it++)
+    {
+      internal::BeanBase* found = find(*it,Id(it->getId()),false);
+      // what's provided only needs to be declared (see Provider<T>::available)
+      if (found == NULL || (it->kind != internal::Dependency::provider && !found->instantiated()))
+        return it->getId() != NULL ? (*(it->getId()) + ":" + it->toString()) : it->toString();
+    }
+    return std::string();
+  }
+
+  DI_INLINE void Context::findDormant(const internal::Registry::View& beans)
+  {
+    // without any roots everything is needed.
+    std::vector<internal::BeanBase*> needed;
+    for (internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
+    {
+      (*it)->dormant = false;
+      if ((*it)->isRoot())
+        needed.push_back(*it);
+    }
+    if (needed.empty())
+      return;
+
+    for (internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
+      (*it)->dormant = !(*it)->isRoot();
+
+    // wake up what the roots need, then what that needs ...
+    while (!needed.empty())
+    {
+      internal::BeanBase* bean = needed.back();
+      needed.pop_back();
+
+      internal::Dependencies dependencies;
+      bean->dependencies(dependencies);
+      for (internal::Dependencies::iterator dit = dependencies.begin(); dit != dependencies.end(); dit++)
+      {
+        std::vector<internal::BeanBase*> found;
+        internal::FindAll visitor(found);
+        visitAll(visitor,*dit,dit->getId(),false);
+        for (std::vector<internal::BeanBase*>::iterator fit = found.begin(); fit != found.end(); fit++)
+          if ((*fit)->dormant)
+          {
+            (*fit)->dormant = false;
+            needed.push_back(*fit);
+          }
+      }
+    }
+  }
+
+  DI_INLINE void Context::findDeferred(const internal::Registry::View& beans)
+  {
+    bool any = false;
+    for (internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
+    {
+      (*it)->deferred = (*it)->isAfterFork() && !(*it)->isDormant();
+      any = any || (*it)->deferred;
+    }
+
+    // whatever can't be created without a deferred instance is deferred too. A 
+    //  Provider doesn't need what it provides to exist.
+    for (bool changed = any; changed; )
+    {
+      changed = false;
+      for (internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
+      {
+        internal::BeanBase* bean = (*it);
+        if (bean->deferred || bean->isDormant())
+          continue;
+
+        internal::Dependencies dependencies;
+        bean->dependencies(dependencies);
+        for (internal::Dependencies::iterator dit = dependencies.begin(); dit != dependencies.end() && !bean->deferred; dit++)
+        {
+          if (dit->kind == internal::Dependency::provider)
+            continue;
+          std::vector<internal::BeanBase*> found;
+          internal::FindAll visitor(found);
+          visitAll(visitor,*dit,dit->getId(),false);
+          for (std::vector<internal::BeanBase*>::iterator fit = found.begin(); fit != found.end(); fit++)
+            if ((*fit)->deferred)
+            {
+              bean->deferred = true;
+              changed = true;
+              break;
+            }
+        }
+      }
+    }
+  }
+
+  DI_INLINE void Context::startDeferred(const std::vector<internal::BeanBase*>& deferred, const std::vector<unsigned long long>& definitions) /* throw (DependencyInjectionException) */
+  {
+    // the same stages as start, for just these.
+    std::vector<internal::BeanBase*> working;
+    for (std::vector<internal::BeanBase*>::const_iterator it = deferred.begin(); it != deferred.end(); it++)
+      if (!(*it)->isLazy())
+        working.push_back(*it);
+
+    while (working.size() > 0)
+    {
+      std::vector<internal::BeanBase*> waiting;
+      for (std::vector<internal::BeanBase*>::iterator it = working.begin(); it != working.end(); it++)
+      {
+        if ((*it)->factory->dependenciesSatisfied(this))
+        {
+          (*it)->instantiateBean(this);
+          DI_PROPAGATE();
+        }
+        else
+          waiting.push_back(*it);
+      }
+
+      if (waiting.size() == working.size())
+        DI_FAIL(, Status::unsatisfied, waiting.front()->toString(), unsatisfiedDependency(waiting.front()), 
+          "Cannot resolve constructor dependencies for \"%s\"", waiting.front()->toString().c_str());
+      working.swap(waiting);
+    }
+
+    for (std::vector<internal::BeanBase*>::const_iterator it = deferred.begin(); it != deferred.end(); it++)
+    {
+      internal::BeanBase* instance = (*it);
+      if (instance->isPrototype() || instance->isLazy())
+        continue;
+      internal::BeanBase::Requirements& requirements = instance->getRequirements();
+      for (unsigned int r = 0; r < instance->numInstances(); r++)
+        for (internal::BeanBase::Requirements::iterator rit = requirements.begin(); rit != requirements.end(); rit++)
+        {
+          (*rit)->satisfy(instance,instance->instanceAt(r),this);
+          DI_PROPAGATE();
+        }
+    }
+
+    for (size_t i = 0; i < deferred.size(); i++)
+      if (!deferred[i]->isLazy())
+        postConstructOrRestore(deferred[i], definitions[i]);
+  }
+
+  DI_INLINE void Context::checkpointDefinitions(const internal::Registry::View& beans, std::vector<unsigned long long>& ret)
+  {
+    // declarations that hash the same (several unnamed instances of one type) are 
+    //  told apart by how many of them came before.
+    std::unordered_map<unsigned long long, unsigned int> seen;
+    ret.assign(beans.size(), 0);
+    for (size_t i = 0; i < beans.size(); i++)
+      if (beans[i]->isCheckpointed())
+      {
+        unsigned long long definition = internal::StartPlan::hashBean(beans[i]);
+        unsigned int before = seen[definition]++;
+        ret[i] = before == 0 ? definition : internal::hashBytes((const char*)&before, sizeof(before), definition);
+      }
+  }
+
+  DI_INLINE void Context::postConstructOrRestore(internal::BeanBase* instance, unsigned long long definition)
+  {
+    if (!instance->isCheckpointed() || !restoredFrom.isOpen())
+    {
+      instance->doPostConstruct();
+      return;
+    }
+
+    for (unsigned int i = 0; i < instance->numInstances(); i++)
+    {
+      const char* data = NULL;
+      size_t size = 0;
+      if (restoredFrom.find(internal::Snapshot::key(definition, i), data, size) && instance->restoreState(i, data, size))
+        numRestored++;
+      else
+        instance->doPostConstructAt(i);
+    }
+  }
+
+  DI_INLINE void Context::checkpoint(const std::string& path) /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    if (!isStarted())
+      DI_FAIL(, Status::wrongPhase, std::string(), std::string(), "checkpoint needs the di::Context to be started.");
+
+    std::vector<internal::Snapshot::State> states;
+    internal::Registry::View beans = registry.view();
+    std::vector<unsigned long long> definitions;
+    checkpointDefinitions(beans, definitions);
+    internal::BeanBase* instance = NULL;
+    DI_TRY
+    {
+      for (size_t b = 0; b < beans.size(); b++)
+      {
+        instance = beans[b];
+        // lazy instances that haven't been needed yet have nothing to save.
+        if (!instance->isCheckpointed() || !instance->instantiated())
+          continue;
+        for (unsigned int i = 0; i < instance->numInstances(); i++)
+        {
+          states.push_back(internal::Snapshot::State(internal::Snapshot::key(definitions[b], i), std::string()));
+          instance->saveState(i, states.back().second);
+        }
+      }
+    }
+    DI_CATCH(DependencyInjectionException&) { DI_RETHROW; }
+    DI_CATCH_ALL
+    {
+      DI_FAIL(, Status::callbackFailed, instance->toString(), std::string(), "Unknown exception intercepted while saving the state of \"%s\" for a checkpoint.", instance->toString().c_str());
+    }
+
+    if (!internal::Snapshot::save(path, states))
+      DI_FAIL(, Status::ioFailed, std::string(), std::string(), "Failed to write the checkpoint to \"%s.\"", path.c_str());
+  }
+
+  DI_INLINE void Context::onForked() /* throw (DependencyInjectionException) */
+  {
+    DI_CLEAR_FAILURE();
+    if (!isStarted())
+      DI_FAIL(, Status::wrongPhase, std::string(), std::string(), "onForked needs the di::Context to have been started (before the fork).");
+
+    internal::Registry::View beans = registry.view();
+    std::vector<unsigned long long> definitions;
+    checkpointDefinitions(beans, definitions);
+    std::vector<internal::BeanBase*> deferred;
+    std::vector<unsigned long long> deferredDefinitions;
+    for (size_t i = 0; i < beans.size(); i++)
+      if (beans[i]->isDeferred())
+      {
+        deferred.push_back(beans[i]);
+        deferredDefinitions.push_back(definitions[i]);
+      }
+
+    DI_TRY
+    {
+      startDeferred(deferred, deferredDefinitions);
+    }
+    DI_CATCH(DependencyInjectionException&) 
+    {
+      for (std::vector<internal::BeanBase*>::iterator it = deferred.begin(); it != deferred.end(); it++)
+        (*it)->reset();
+      DI_RETHROW; 
+    }
+    DI_CATCH_ALL
+    {
+      for (std::vector<internal::BeanBase*>::iterator it = deferred.begin(); it != deferred.end(); it++)
+        (*it)->reset();
+      DI_FAIL(, Status::callbackFailed, std::string(), std::string(), "Unknown exception intercepted while starting the instances left for onForked.");
+    }
+    if (DI_FAILED())
+    {
+      for (std::vector<internal::BeanBase*>::iterator it = deferred.begin(); it != deferred.end(); it++)
+        (*it)->reset();
+      return;
+    }
+
+    for (std::vector<internal::BeanBase*>::iterator it = deferred.begin(); it != deferred.end(); it++)
+      (*it)->deferred = false;
+  }
+
+  DI_INLINE void Context::runStart() /* throw (DependencyInjectionException) */
+  {
+    Starting starting(this);
+    DI_TRY
+    {
+      doStart();
+    }
+    DI_CATCH_ALL
+    {
+      abandonStart();
+      DI_RETHROW;
+    }
+    if (DI_FAILED())
+      abandonStart();
+    else
+      finishStart(true);
+  }
+
+  DI_INLINE void Context::abandonStart()
+  {
+    // a failed start doesn't leave instances behind (see 'start()'), so that it
+    //  can be fixed and tried again.
+    DI_TRY { resetBeans(); } DI_CATCH_ALL {}
+    finishStart(false);
+  }
+
+  DI_INLINE void Context::doStart() /* throw (DependencyInjectionException) */
+  {
+    // the declarations are complete (on every thread) so index them for the lookups
+    //  that follow. The whole start works from one snapshot of the declared instances.
+    publishStaged(true);
+    registry.buildIndex();
+    internal::Registry::View beans = registry.view();
+
+#if !DI_EXCEPTIONS
+    // mistakes in the declarations couldn't be thrown when they were made.
+    for(internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
+      if ((*it)->declarationError != NULL)
+      {
+        internal::pendingFailure() = *((*it)->declarationError);
+        DependencyInjectionException ex("%s", (*it)->declarationError->message.c_str());
+        return;
+      }
+#endif
+
+    findDormant(beans);
+    findDeferred(beans);
+
+    unsigned int toStart = 0;
+    for (internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
+      if ((*it)->createdByStart())
+        toStart++;
+    numToStart = toStart;
+    {
+      std::lock_guard<std::mutex> lock(readyLock);
+      planned = true;
+    }
+    // anyone waiting for an instance this start won't create can stop.
+    readyCondition.notify_all();
+
+    // a plan from the last start (of the same declarations) gives an instantiation 
+    //  order that works in one pass. Each step is still checked so a stale plan 
+    //  falls back to working the order out below.
+    internal::StartPlan previous;
+    unsigned long long definition = 0;
+    if (planFile.size() > 0)
+    {
+      definition = internal::StartPlan::hashDefinition(beans);
+      usedPlan = previous.load(planFile, definition, beans.size());
+    }
+    else
+      usedPlan = false;
+
+    // what this start learns, by bean, for the next one. 
+    std::vector<internal::StartPlan::Step> byBean(beans.size());
+    std::vector<size_t> instantiationOrder;
+    instantiationOrder.reserve(beans.size());
+    for (size_t i = 0; i < beans.size(); i++)
+      byBean[i].bean = i;
+    for (std::vector<internal::StartPlan::Step>::iterator it = previous.steps.begin(); it != previous.steps.end(); it++)
+      byBean[it->bean].warmUp = it->warmUp;
+
+    // First instantiate. Anything whose constructor requirements aren't available 
+    //  yet waits for the next pass.
+    internal::BeanBase* instance = NULL;
+    DI_TRY
+    {
+      std::vector<size_t> workingList;
+      workingList.reserve(beans.size());
+      if (usedPlan)
+        for (std::vector<internal::StartPlan::Step>::iterator it = previous.steps.begin(); it != previous.steps.end(); it++)
+          workingList.push_back(it->bean);
+      else
+        for (size_t i = 0; i < beans.size(); i++)
+          workingList.push_back(i);
 
       while (workingList.size() > 0)
       {
         unsigned int preCount = workingList.size();
         internal::BeanBase* firstNotInstantiated = NULL;
 
-        std::vector<internal::BeanBase*> tmpvector;
+        std::vector<size_t> tmpvector;
 
-        for(std::vector<internal::BeanBase*>::iterator it = workingList.begin(); it != workingList.end(); it++)
+        for(std::vector<size_t>::iterator it = workingList.begin(); it != workingList.end(); it++)
         {
-          instance = (*it);
-          if (instance->factory->dependenciesSatisfied(this))
+          instance = beans[*it];
+          // lazy instances are created when they're first needed, dormant ones not at all
+          //  and deferred ones by onForked. They keep their place in the plan.
+          if (!instance->createdByStart())
+            instantiationOrder.push_back(*it);
+          else if (instance->factory->dependenciesSatisfied(this))
+          {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
             instance->instantiateBean(this);
-          else if (firstNotInstantiated == NULL)
+            DI_PROPAGATE();
+            byBean[*it].instantiate = std::chrono::steady_clock::now() - begin;
+            instantiationOrder.push_back(*it);
+            numInstantiated++;
+          }
+          else
           {
-            firstNotInstantiated = instance;
-            tmpvector.push_back(instance);
+            if (firstNotInstantiated == NULL)
+              firstNotInstantiated = instance;
+            tmpvector.push_back(*it);
           }
         }
 
-        workingList = tmpvector;
+        workingList.swap(tmpvector);
 
         if (preCount == workingList.size() && workingList.size() > 0)
-          throw DependencyInjectionException("Cannot resolve constructor dependencies for \"%s\"", firstNotInstantiated->toString().c_str());
+          DI_FAIL(, Status::unsatisfied, firstNotInstantiated->toString(), unsatisfiedDependency(firstNotInstantiated), 
+            "Cannot resolve constructor dependencies for \"%s\"", firstNotInstantiated->toString().c_str());
       }
     }
-    catch (DependencyInjectionException& die) { throw die; }
-    catch (...)
+    DI_CATCH(DependencyInjectionException&) { DI_RETHROW; }
+    DI_CATCH_ALL
     {
       // hum .... what to do? c++ sucks here in that I cannot get a handle to the 
       // original exception. ... I can either log and rethrow or I can throw another
       // known exception. I wish I could wrap and throw.
+      // 'instance' is still NULL if building the working list failed.
+      std::string bean = instance == NULL ? std::string() : instance->toString();
       resetBeans();
-      throw DependencyInjectionException("Unknown exception intercepted while instantiating \"%s.\"", instance->toString().c_str());
+      DI_FAIL(, Status::callbackFailed, bean, std::string(), "Unknown exception intercepted while instantiating \"%s.\"", bean.c_str());
     }
 
     // we need a map of Instance types to the Beans that provide those types
-    for(std::vector<internal::BeanBase*>::iterator it = instances.begin(); it != instances.end(); it++)
+    for(internal::Registry::iterator it = beans.begin(); it != beans.end(); it++)
     {
       instance = (*it);
 
-      // find out what it requires.
-      std::vector<internal::RequirementBase*>& requirements = instance->getRequirements();
-      for (std::vector<internal::RequirementBase*>::iterator rit = requirements.begin(); rit != requirements.end(); rit++)
+      // prototypes are wired each time an instance of one is acquired, and lazy
+      //  instances when they're created.
+      if (!instance->createdByStart())
+        continue;
+      if (instance->isPrototype())
       {
-        internal::RequirementBase* requirement = (*rit);
-        requirement->satisfy(instance,this);
+        numWired++;
+        continue;
       }
+
+      // find out what it requires. Each replica of a replicated Bean is wired.
+      internal::BeanBase::Requirements& requirements = instance->getRequirements();
+      for (unsigned int r = 0; r < instance->numInstances(); r++)
+        for (internal::BeanBase::Requirements::iterator rit = requirements.begin(); rit != requirements.end(); rit++)
+        {
+          internal::RequirementBase* requirement = (*rit);
+          requirement->satisfy(instance,instance->instanceAt(r),this);
+          DI_PROPAGATE();
+        }
+      numWired++;
     }
 
-    // post construct step
-    for(std::vector<internal::BeanBase*>::iterator it = instances.begin(); it != instances.end(); it++)
+    // post construct step. A checkpoint can stand in for the checkpointed ones'.
+    numRestored = 0;
+    std::vector<unsigned long long> definitions;
+    if (checkpointFile.size() > 0 && restoredFrom.open(checkpointFile))
+      checkpointDefinitions(beans, definitions);
+    for(size_t i = 0; i < beans.size(); i++)
     {
-      instance = (*it);
-      try
+      instance = beans[i];
+      // lazy instances are postConstructed when they're created. None of these are
+      //  ready since this start never creates them (see 'waitFor').
+      if (!instance->createdByStart())
+        continue;
+      DI_TRY
       {
-        instance->doPostConstruct();
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        postConstructOrRestore(instance, restoredFrom.isOpen() ? definitions[i] : 0);
+        byBean[i].postConstruct = std::chrono::steady_clock::now() - begin;
       }
-      catch (DependencyInjectionException& die) { throw die; }
-      catch (...)
+      DI_CATCH(DependencyInjectionException&) { DI_RETHROW; }
+      DI_CATCH_ALL
       {
         // hum .... what to do? c++ sucks here in that I cannot get a handle to the 
         // original exception. ... I can either log and rethrow or I can throw another
         // known exception. I wish I could wrap and throw.
         resetBeans();
-        throw DependencyInjectionException("Unknown exception intercepted while executing postConstruct phase on \"%s.\"", instance->toString().c_str());
+        DI_FAIL(, Status::callbackFailed, instance->toString(), std::string(), "Unknown exception intercepted while executing postConstruct phase on \"%s.\"", instance->toString().c_str());
       }
+      markReady(instance);
     }
 
-    curPhase = started;
+    doWarmUp(byBean);
+    lastTimings = byBean;
+
+    if (planFile.size() > 0)
+    {
+      internal::StartPlan plan;
+      plan.definition = definition;
+      for (std::vector<size_t>::iterator it = instantiationOrder.begin(); it != instantiationOrder.end(); it++)
+        plan.steps.push_back(byBean[*it]);
+
+      // the plan only makes the next start faster so failing to save it doesn't 
+      //  fail this one. This prints a message to the log.
+      if (!plan.save(planFile))
+        DependencyInjectionException ex("Failed to save the start plan to \"%s.\"", planFile.c_str());
+    }
   }
 }
@@ -9,13 +9,61 @@
 
 #include "Exception.h"
 
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <typeindex>
+#include <type_traits>
 #include <typeinfo>
+#include <unordered_map>
+#include <utility>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+// the registry's bulk scans use SSE2 where it's available (see internal/discan.h)
+#if !defined(DI_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define DI_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// checkpoints are mapped into memory rather than read where that's available (see
+//  internal/disnapshot.h)
+#if !defined(DI_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define DI_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef DI__DEPENDENCY_INJECTION_DEBUG
 #include <iostream>
 #endif
 
+/**
+ * An Id for a string literal that's hashed at compile time and interned the first
+ *  time the expression is evaluated. After that it costs a function local static.
+ */
+#define DI_ID(literal) \
+  ([]() -> const ::di::Id& { \
+    static constexpr unsigned long long hash = ::di::internal::hashSymbol(literal, sizeof(literal) - 1); \
+    static const ::di::Id id(literal, sizeof(literal) - 1, hash); \
+    return id; }())
+
 #ifdef DI_HEADER_ONLY
 #define DI_INLINE inline
 #else
@@ -122,6 +170,9 @@
  *  context.has(Instance<Bar>()).isAlso(Instance<IBar>());
  *  context.start();
  *
+ * The setter can take the vector by value, by const reference or as an rvalue
+ *  reference (in which case it can keep the vector without copying it).
+ *
  * Note that this example combines the abstraction with the set injection but it
  * would (of course) also work with simple concrete types. Given 
  * 'void Foo::setBars(const std::vector<Bar*>)' the following is fine:
@@ -168,7 +219,8 @@
  * 1) Instantiation - instantiation of the defined instances.
  * 2) Wiring - satisfying of the requirements via calling the identified setters
  * 3) PostConstruction - which calls all of the postConstruct methods that
- *    were declared to the context.
+ *    were declared to the context. This is followed by the WarmUp of any
+ *    instances that declared a warmUp method (see "Warm up" below).
  * ...
  * 4) PreDestruction - which calls all of the preDestroy methods that
  *    were declared to the context.
@@ -193,6 +245,140 @@
  * NOTE: Currently the Context expects only one postConstruct (and/or) preDestroy callback
  * to be registered per instance. 
  *
+ * Prototypes:
+ *
+ * By default every instance is a singleton that's created during start. Instances that
+ * are needed per use (large parse buffers for example) can be declared as prototypes
+ * and acquired when needed. Released instances are pooled for reuse:
+ *
+ *   context.has(Instance<Buffer>()).pooled(64, &Buffer::clear);
+ *   ...
+ *   Lease<Buffer> buffer = context.acquire(Instance<Buffer>());
+ *   buffer->parse(...);
+ *
+ * Roots:
+ *
+ * A module of declarations shared between programs usually declares more than any
+ * one program needs. Marking the instances a program uses as roots limits start to
+ * those and whatever they depend on. The rest stay declared but dormant:
+ *
+ *   context.install(sharedModule);
+ *   context.has(Instance<Server>(), Instance<Config>()).root();
+ *
+ * Replicas:
+ *
+ * Instances that many threads write to at once (counters, statistics) can be 
+ * replicated so that each thread mostly writes to a replica of it's own, on it's own
+ * cache lines. They're injected as Replicas (see di::Replicas) which finds the
+ * calling thread's replica and can combine all of them when they're read:
+ *
+ *   context.has(Instance<Counter>()).replicated();
+ *   context.has(Instance<Requests>()).requires(Instance<Counter>(), &Requests::setCounters);
+ *
+ * Decorators:
+ *
+ * Timing or counting the calls made through an interface doesn't need changes to the
+ * classes that implement it. An instance can declare a decorator for an interface it
+ * isAlso and whatever requires that interface is injected with the decorator, which
+ * is constructed with the instance itself:
+ *
+ *   context.has(Instance<Foo>()).isAlso(Instance<IFoo>()).decorate<IFoo>(Instance<TimingFoo>());
+ *
+ * Swapping:
+ *
+ * An instance built from something that changes while the program runs (a routing
+ * table from a configuration file) can be declared swappable and replaced without 
+ * a restart. What depends on it is injected with a Swappable (see di::Swappable)
+ * that always finds the current instance:
+ *
+ *   context.has(Instance<Routes>(), Instance<Config>()).swappable();
+ *   ...
+ *   context.replace(Instance<Routes>());
+ *
+ * Forking:
+ *
+ * A server that forks worker processes can start the context once, before forking, so
+ * the workers share what it creates. Instances that can't be shared between processes
+ * are declared 'afterFork' and are created in each worker by 'onForked':
+ *
+ *   context.has(Instance<Listener>(), Instance<Routes>()).afterFork();
+ *   context.start();
+ *   if (fork() == 0)
+ *     context.onForked();
+ *
+ * Concurrency:
+ *
+ * Looking things up in a Context (get, find, findAll) never takes a lock and can be 
+ * done from any number of threads, including while other threads declare new 
+ * instances with 'has'. Readers see an immutable snapshot of the declared instances.
+ * Old snapshots are freed once no reader is using them anymore. The lifecycle stages
+ * (start, stop, clear) still expect that nothing else is using the instances they 
+ * create and delete.
+ *
+ * Declaring ('has' and the Bean methods chained to it) can also be done from any 
+ * number of threads at once, so that subsystems can declare their instances in
+ * parallel. What a thread declares is kept aside until that thread looks something
+ * up, or until start, and then published in one go. So each thread sees what it has
+ * declared itself, every thread sees everything once the context is started, and a
+ * thread has to be done declaring an instance before it looks anything up.
+ *
+ * Asynchronous start:
+ *
+ * Context::start blocks until every instance has been postConstructed. If the calling
+ * thread needs to get on with something else (an event loop, answering health probes)
+ * then use 'startAsync' instead. It runs the same lifecycle stages on a background
+ * thread and returns a std::future that completes (or rethrows) when the start does:
+ *
+ *   std::future<void> done = context.startAsync();
+ *   ... do other things, maybe look at context.progress() ...
+ *   Foo* foo = context.waitFor(Instance<Foo>()); // blocks until Foo is postConstructed
+ *   done.get();
+ *
+ * Warm up:
+ *
+ * Work that only makes an instance faster (prefilling caches, compiling tables,
+ * touching memory) doesn't need to hold up the postConstruct stage. It can be
+ * registered as a separate "warm up" callback instead:
+ *
+ *   context.has(Instance<Foo>()).warmUp(&Foo::fillCache);
+ *   context.setWarmUpBudget(std::chrono::milliseconds(500));
+ *
+ * Warm up methods run after every postConstruct has completed, concurrently across
+ * instances. Once the budget is spent (or stop() is called) no further warm up 
+ * methods are started. Long running ones can poll Context::isWarmUpCancelled() to
+ * finish early. Context::warmUpReport() gives the time each one took.
+ *
+ * Checkpoints:
+ *
+ * An instance whose postConstruct builds something that comes out the same every
+ * run (an index, compiled tables) can save it instead, with Context::checkpoint, and
+ * have the next run's start restore it:
+ *
+ *   context.has(Instance<Index>()).postConstruct(&Index::build).checkpointed(&Index::save, &Index::restore);
+ *   context.setCheckpointFile("index.dichk");
+ *   context.start();   // restores the Index if the file has it, builds it otherwise
+ *   context.checkpoint("index.dichk");
+ *
+ * The file is mapped into memory where that's available so 'restore' can use the
+ * saved state in place. State is only restored into the declaration that saved it.
+ *
+ * Errors:
+ *
+ * Failures are reported by throwing a DependencyInjectionException. Alternatively
+ * tryStart, tryStop, tryInstall and tryGet return a Status with the kind of failure,
+ * the instance it happened to and (when that's the reason) the requirement that
+ * couldn't be satisfied:
+ *
+ *   Status status = context.tryStart();
+ *   if (!status.isOk())
+ *     log(status.kind, status.bean, status.requirement, status.message);
+ *
+ * The library also compiles without exceptions (e.g. -fno-exceptions). Then the
+ * methods that would have thrown log the message and return (NULL, an empty Lease,
+ * a context that didn't start) and the 'try' methods are how to find out what went
+ * wrong. A mistake in a declaration (postConstruct twice, say) is reported by the
+ * next start.
+ *
  */
 
 namespace di
@@ -208,8 +394,90 @@ namespace di
     return stream;
   }
 
+  /**
+   * What the 'try' methods (Context::tryStart, tryStop, tryGet, tryInstall) return
+   *  rather than throwing. When it isn't 'ok' it says what kind of failure it was,
+   *  which instance it happened to and, when that's the reason, what that instance
+   *  required that couldn't be provided. 'message' is what the exception would have
+   *  said.
+   */
+  struct Status
+  {
+    enum Kind
+    {
+      ok = 0,
+      wrongPhase,       // the context wasn't started (or stopped) when it needed to be
+      notFound,         // there's no such instance
+      unsatisfied,      // nothing satisfies a requirement or constructor parameter
+      ambiguous,        // more than one thing satisfies a requirement
+      notInjectable,    // a prototype or lazy instance was required without a Provider
+      conversionFailed, // an isAlso declaration was wrong (the dynamic_cast failed)
+      badDeclaration,   // something was declared twice or in a way that conflicts
+      callbackFailed,   // a constructor or lifecycle method threw
+      ioFailed,         // a file couldn't be written (see Context::checkpoint)
+      notCreated        // the start doesn't create it: it's lazy, dormant or left for onForked
+    };
+
+    Kind kind;
+    std::string bean;
+    std::string requirement;
+    std::string message;
+
+    inline Status() : kind(ok) {}
+    inline Status(Kind kind_, const std::string& bean_, const std::string& requirement_, const std::string& message_) :
+      kind(kind_), bean(bean_), requirement(requirement_), message(message_) {}
+
+    inline bool isOk() const { return kind == ok; }
+  };
+
+  // Nothing to see here, move along ...
+  #include "internal/dierror.h"
+  #include "internal/disymbol.h"
+
+  /**
+   * The name of an instance. Ids are interned when they're created so that
+   *  comparing two of them (which is what every lookup by id does) is comparing
+   *  two pointers. Creating an Id from a string costs a hash and a (brief) lock 
+   *  so code that looks things up by id on a hot path should create the Id once
+   *  and hold onto it, or use DI_ID with a literal:
+   *
+   *   Foo* foo = context.get(Instance<Foo>(), DI_ID("foo"));
+   *
+   * Strings (const char*, std::string and, with C++17, std::string_view) all 
+   *  convert implicitly so anywhere an Id is expected a string can be used.
+   */
+  class Id
+  {
+    internal::Symbol sym;
+
+  public:
+    inline Id() noexcept : sym(NULL) {}
+    inline Id(const char* str) : sym(str ? internal::SymbolTable::intern(str, std::strlen(str)) : NULL) {}
+    inline Id(const std::string& str) : sym(internal::SymbolTable::intern(str.data(), str.size())) {}
+#if __cplusplus >= 201703L
+    inline Id(std::string_view str) : sym(internal::SymbolTable::intern(str.data(), str.size())) {}
+#endif
+
+    /**
+     * 'hash' must be internal::hashSymbol(str,len). This is what DI_ID uses to
+     *  do the hashing at compile time.
+     */
+    inline Id(const char* str, size_t len, unsigned long long hash) : sym(internal::SymbolTable::intern(str, len, hash)) {}
+
+    inline explicit Id(internal::Symbol symbol_) noexcept : sym(symbol_) {}
+
+    inline internal::Symbol symbol() const noexcept { return sym; }
+    inline bool isSet() const noexcept { return sym != NULL; }
+    inline const char* c_str() const noexcept { return sym ? sym->c_str() : NULL; }
+
+    inline bool operator==(const Id& other) const noexcept { return sym == other.sym; }
+    inline bool operator!=(const Id& other) const noexcept { return sym != other.sym; }
+  };
+
   // Nothing to see here, move along ...
   #include "internal/dibase.h"
+  #include "internal/direclaimer.h"
+  #include "internal/dipool.h"
 
   /**
    * This class represents the means of declaring type information
@@ -230,8 +498,9 @@ namespace di
   template <class T> class Instance : public internal::InstanceBase
   {
   public:
-    inline Instance() noexcept : internal::InstanceBase(typeid(T)) {}
-    inline Instance(const char* id) noexcept : internal::InstanceBase(id,typeid(T)) {}
+    inline Instance() noexcept : internal::InstanceBase(typeid(T), internal::typeTag<T>()) {}
+    inline Instance(const char* id) : internal::InstanceBase(Id(id).symbol(),typeid(T), internal::typeTag<T>()) {}
+    inline Instance(const Id& id) noexcept : internal::InstanceBase(id.symbol(),typeid(T), internal::typeTag<T>()) {}
     virtual ~Instance() {}
 
     /**
@@ -255,6 +524,8 @@ namespace di
     inline void findAll(std::vector<internal::BeanBase*>& ret, Context* context, bool exact = true) const /* throw (DependencyInjectionException) */;
     inline T* findIsAlso(Context* context) const /* throw (DependencyInjectionException) */;
     inline bool available(Context* context) const;
+
+    inline void addDependency(internal::Dependencies& ret) const { ret.push_back(internal::Dependency(*this, internal::Dependency::constructor)); }
  };
 
   /**
@@ -273,9 +544,10 @@ namespace di
 
     inline const std::string toString() const { return std::string("Constant<").append(Instance<T>().toString()).append(">"); }
     inline void findAll(std::vector<internal::BeanBase*>& ret, Context* context, bool exact = true) 
-      const /* throw (DependencyInjectionException) */ { throw DependencyInjectionException("Cannot find all instances of a Constant in a container"); }
-    inline const T& findIsAlso(Context* context) noexcept { return instance; }
-    inline bool available(Context* context) noexcept { return true; }
+      const /* throw (DependencyInjectionException) */ { DI_FAIL(, Status::badDeclaration, std::string(), toString(), "Cannot find all instances of a Constant in a container"); }
+    inline const T& findIsAlso(Context* /*context*/) noexcept { return instance; }
+    inline bool available(Context* /*context*/) noexcept { return true; }
+    inline void addDependency(internal::Dependencies& /*ret*/) const {}
   };
 
   // Nothing to see here, move along ...
@@ -287,41 +559,243 @@ namespace di
   template<class T> class Bean : public internal::BeanBase
   {
     friend class Context;
+    template<class D> friend class Declarations;
+    friend class Lease<T>;
+    friend class Provider<T>;
 
   public:
     typedef void (T::*PostConstructMethod)();
     typedef void (T::*PreDestroyMethod)();
+    typedef void (T::*WarmUpMethod)();
+    typedef void (T::*ResetMethod)();
+    typedef void (T::*SaveMethod)(std::string& state);
+    typedef bool (T::*RestoreMethod)(const char* data, size_t size);
 
   private:
+    /**
+     * The lifecycle methods. Each of them is optional so they're kept out of line
+     *  and a Bean that doesn't declare any shares the empty set ('none').
+     */
+    struct Methods
+    {
+      PostConstructMethod postConstruct;
+      PreDestroyMethod preDestroy;
+      WarmUpMethod warmUp;
+      SaveMethod save;
+      RestoreMethod restore;
+      ResetMethod reset; // only used by prototypes
+    };
+
     T* ref;
+    Methods* methods;
 
-    PostConstructMethod postConstructMethod;
-    PreDestroyMethod preDestroyMethod;
+    // only used by prototypes
+    internal::Pool* pool;
 
+    static inline Methods* none() { static Methods empty = Methods(); return &empty; }
+
+    // the methods, to declare one of them
+    inline Methods& declared() { if (methods == none()) methods = new Methods(*none()); return *methods; }
+
+    // prototypes don't have a singleton instance (ref) so these only apply to the 
+    //  instances they hand out. Replicated Beans have one per replica instead.
     virtual void doPostConstruct()
     {
-      if (postConstructMethod != NULL)
-        ((*get()).*(postConstructMethod))();
+      if (methods->postConstruct != NULL && (ref != NULL || replicas != NULL))
+        for (unsigned int i = 0; i < numInstances(); i++)
+          (((T*)instanceAt(i))->*(methods->postConstruct))();
+    }
+
+    virtual void doPostConstructAt(unsigned int i)
+    {
+      if (methods->postConstruct != NULL && (ref != NULL || replicas != NULL))
+        (((T*)instanceAt(i))->*(methods->postConstruct))();
+    }
+
+    virtual bool isCheckpointed() const { return methods->save != NULL; }
+
+    virtual void saveState(unsigned int i, std::string& state)
+    {
+      if (methods->save != NULL && (ref != NULL || replicas != NULL))
+        (((T*)instanceAt(i))->*(methods->save))(state);
+    }
+
+    virtual bool restoreState(unsigned int i, const char* data, size_t size)
+    {
+      return methods->restore != NULL && (ref != NULL || replicas != NULL) && (((T*)instanceAt(i))->*(methods->restore))(data, size);
     }
 
     virtual void doPreDestroy()
     {
-      if (preDestroyMethod != NULL)
-        ((*get()).*(preDestroyMethod))();
+      if (methods->preDestroy != NULL && (ref != NULL || replicas != NULL))
+        for (unsigned int i = 0; i < numInstances(); i++)
+          (((T*)instanceAt(i))->*(methods->preDestroy))();
+    }
+
+    virtual void doWarmUp()
+    {
+      if (methods->warmUp != NULL && (ref != NULL || replicas != NULL))
+        for (unsigned int i = 0; i < numInstances(); i++)
+          (((T*)instanceAt(i))->*(methods->warmUp))();
+    }
+
+    virtual bool hasWarmUp() const { return methods->warmUp != NULL && !prototypeScope && !lazyScope && !dormant && !deferred; }
+
+    inline explicit Bean(internal::FactoryBase* factory, internal::Symbol name) : 
+      BeanBase(factory, name,Instance<T>()), ref(NULL), methods(none()), pool(NULL) { isAlso(Instance<T>()); }
+
+    inline virtual ~Bean() { if (pool) { drainPool(); delete pool; } delete swapCell; if (methods != none()) delete methods; }
+
+    /**
+     * Creates, wires and postConstructs a new instance of a prototype, unless 
+     *  there's already one in the pool.
+     */
+    inline T* acquireInstance(Context* c) /* throw (DependencyInjectionException) */
+    {
+      T* ret = (T*)pool->take();
+      return ret != NULL ? ret : buildInstance(c);
+    }
+
+    /**
+     * Creates, wires and postConstructs a new instance outside of the lifecycle 
+     *  stages: for a prototype or to replace a swappable instance.
+     */
+    inline T* buildInstance(Context* c) /* throw (DependencyInjectionException) */
+    {
+      T* ret = (T*)factory->create(c);
+      DI_PROPAGATE(NULL);
+      DI_TRY
+      {
+        for (Requirements::iterator it = requirements.begin(); it != requirements.end(); it++)
+        {
+          (*it)->satisfy(this,ret,c);
+          if (DI_FAILED())
+          {
+            factory->destroy(ret);
+            return NULL;
+          }
+        }
+        if (methods->postConstruct != NULL)
+          (ret->*(methods->postConstruct))();
+      }
+      DI_CATCH_ALL
+      {
+        factory->destroy(ret);
+        DI_RETHROW;
+      }
+      return ret;
+    }
+
+    inline void releaseInstance(T* instance)
+    {
+      if (methods->reset != NULL)
+        (instance->*(methods->reset))();
+      if (!pool->put(instance))
+        destroyInstance(instance);
+    }
+
+    inline void destroyInstance(T* instance)
+    {
+      if (methods->preDestroy != NULL)
+        (instance->*(methods->preDestroy))();
+      factory->destroy(instance);
+    }
+
+    /**
+     * An instance that was replaced (see 'replaceInstance') waiting for it's 
+     *  readers to leave.
+     */
+    struct Replaced
+    {
+      Bean<T>* bean;
+      T* instance;
+    };
+
+    static inline void destroyReplaced(void* p)
+    {
+      Replaced* replaced = (Replaced*)p;
+      replaced->bean->destroyInstance(replaced->instance);
+      delete replaced;
+    }
+
+    inline void replaceInstance(Context* c) /* throw (DependencyInjectionException) */
+    {
+      std::lock_guard<std::mutex> lock(swapCell->swapLock);
+      T* replacement = buildInstance(c);
+      DI_PROPAGATE();
+
+      Replaced* replaced = new Replaced;
+      replaced->bean = this;
+      replaced->instance = ref;
+      ref = replacement;
+      swapCell->current.store(replacement);
+      swapCell->reclaimer.retire(replaced, &destroyReplaced);
     }
 
-    inline explicit Bean(internal::FactoryBase* factory, const char* name) : 
-      BeanBase(factory, name,Instance<T>()), postConstructMethod(NULL), ref(NULL),
-      preDestroyMethod(NULL) { isAlso(Instance<T>()); }
+    inline void destroyReplicas()
+    {
+      for (unsigned int i = 0; i < replicas->constructed; i++)
+        factory->destroyAt(replicas->at(i));
+      delete replicas;
+      replicas = NULL;
+    }
 
-    inline virtual ~Bean() {}
+    inline void drainPool()
+    {
+      std::vector<void*> drained;
+      pool->close(drained);
+      for (std::vector<void*>::iterator it = drained.begin(); it != drained.end(); it++)
+        destroyInstance((T*)(*it));
+    }
 
   protected:
-    virtual inline const void* getConcrete() const { return ref; }
+    virtual inline const void* getConcrete() const 
+    { 
+      if (swapCell)
+        return swapCell->current.load(std::memory_order_acquire);
+      return replicas ? replicas->at(internal::threadShard() % replicaCount) : ref; 
+    }
+
+    virtual inline size_t footprint() const { return sizeof(*this) + BeanBase::footprint() + (pool ? sizeof(internal::Pool) : 0) + (methods != none() ? sizeof(Methods) : 0); }
+
+    virtual inline size_t instanceSize() const { return sizeof(T) * numInstances(); }
 
-    virtual inline void instantiateBean(Context* c) { ref = (T*)factory->create(c); hasBean = true; }
+    virtual inline void instantiateBean(Context* c) 
+    { 
+      if (pool)
+        pool->open();
+      else if (replicaCount)
+      {
+        replicas = new internal::ReplicaStorage(replicaCount, sizeof(T));
+        for (; replicas->constructed < replicaCount; replicas->constructed++)
+        {
+          factory->createAt(c, replicas->at(replicas->constructed));
+          if (DI_FAILED())
+          {
+            destroyReplicas();
+            return;
+          }
+        }
+      }
+      else
+      {
+        ref = (T*)factory->create(c); 
+        DI_PROPAGATE();
+        if (decorators != NULL)
+        {
+          createDecorators();
+          DI_PROPAGATE();
+        }
+        if (swapCell)
+          swapCell->current.store(ref);
+      }
+      hasBean = true; 
+    }
 
-    virtual inline void reset() { if (ref) delete ref; ref = NULL; }
+    virtual inline void compact();
+
+    // nothing can be reading a swappable instance once it's being reset.
+    virtual inline void reset() { if (swapCell) { swapCell->reclaimer.reclaim(true); swapCell->current.store(NULL); } destroyDecorators(); if (ref) factory->destroy(ref); ref = NULL; hasBean = false; if (pool) drainPool(); if (replicas) destroyReplicas(); }
 
   public:
 
@@ -331,9 +805,9 @@ namespace di
      *  hierarchies are not understood by the DI API (if someone can figure out
      *  a way to do this then be my guest).
      */
-    template<typename D> inline Bean<T>& isAlso(const Instance<D>& typeInfo) /* throw (DependencyInjectionException) */
+    template<typename D> inline Bean<T>& isAlso(const Instance<D>& /*typeInfo*/) /* throw (DependencyInjectionException) */
     {
-      isAlsoTheseInstances.push_back(new internal::InstanceConverter<D,T>);
+      isAlsoTheseInstances.push_back(internal::InstanceConverter<D,T>::get());
       return *this; 
     }
 
@@ -359,13 +833,79 @@ namespace di
       return *this;
     }
 
+    /**
+     * Use this method to declare that this instance requires a Provider for a 
+     * particular dependency rather than the dependency itself (see di::Provider).
+     */
+    template<typename D> inline Bean<T>& requires(const Instance<D>& dependency, typename internal::SetterProvider<T,D>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementProvider<T,D,typename internal::SetterProvider<T,D>::type>(dependency,setter));
+      return *this;
+    }
+
+    template<typename D> inline Bean<T>& requires(const Instance<D>& dependency, typename internal::SetterProviderRef<T,D>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementProvider<T,D,typename internal::SetterProviderRef<T,D>::type>(dependency,setter));
+      return *this;
+    }
+
+    /**
+     * Use this method to declare that this instance requires the replicas of a 
+     * replicated dependency (see di::Replicas and 'replicated').
+     */
+    template<typename D> inline Bean<T>& requires(const Instance<D>& dependency, typename internal::SetterReplicas<T,D>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementReplicas<T,D,typename internal::SetterReplicas<T,D>::type>(dependency,setter));
+      return *this;
+    }
+
+    template<typename D> inline Bean<T>& requires(const Instance<D>& dependency, typename internal::SetterReplicasRef<T,D>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementReplicas<T,D,typename internal::SetterReplicasRef<T,D>::type>(dependency,setter));
+      return *this;
+    }
+
+    /**
+     * Use this method to declare that this instance requires a swappable 
+     * dependency (see di::Swappable and 'swappable').
+     */
+    template<typename D> inline Bean<T>& requires(const Instance<D>& dependency, typename internal::SetterSwappable<T,D>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementSwappable<T,D,typename internal::SetterSwappable<T,D>::type>(dependency,setter));
+      return *this;
+    }
+
+    template<typename D> inline Bean<T>& requires(const Instance<D>& dependency, typename internal::SetterSwappableRef<T,D>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementSwappable<T,D,typename internal::SetterSwappableRef<T,D>::type>(dependency,setter));
+      return *this;
+    }
+
     /**
      * Use this method to declare that this instance requires a particular
      * dependency.
      */
     template<typename D> inline Bean<T>& requiresAll(const Instance<D>& dependency, typename internal::SetterAll<T,D*>::type setter) 
     {
-      requirements.push_back(new internal::RequirementAll<T,Instance<D>,D*>(dependency,setter));
+      requirements.push_back(new internal::RequirementAll<T,Instance<D>,D*,typename internal::SetterAll<T,D*>::type>(dependency,setter));
+      return *this;
+    }
+
+    /**
+     * The same as the above but for setters that take the vector by const reference.
+     */
+    template<typename D> inline Bean<T>& requiresAll(const Instance<D>& dependency, typename internal::SetterAllRef<T,D*>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementAll<T,Instance<D>,D*,typename internal::SetterAllRef<T,D*>::type>(dependency,setter));
+      return *this;
+    }
+
+    /**
+     * The same as the above but for setters that take ownership of the vector.
+     */
+    template<typename D> inline Bean<T>& requiresAll(const Instance<D>& dependency, typename internal::SetterAllMove<T,D*>::type setter) 
+    {
+      requirements.push_back(new internal::RequirementAll<T,Instance<D>,D*,typename internal::SetterAllMove<T,D*>::type>(dependency,setter));
       return *this;
     }
 
@@ -375,10 +915,10 @@ namespace di
      */
     inline Bean<T>& postConstruct(PostConstructMethod postConstructMethod_) /* throw (DependencyInjectionException) */
     {
-      if (postConstructMethod != NULL)
-        throw DependencyInjectionException("Multiple postConstruct registrations detected for '%s'. \"There can be only one (per instance).\"",this->toString().c_str());
+      if (methods->postConstruct != NULL)
+        DI_FAIL_DECLARATION("Multiple postConstruct registrations detected for '%s'. \"There can be only one (per instance).\"",this->toString().c_str());
 
-      postConstructMethod = postConstructMethod_;
+      declared().postConstruct = postConstructMethod_;
       return *this;
     }
 
@@ -388,115 +928,700 @@ namespace di
      */
     inline Bean<T>& preDestroy(PreDestroyMethod preDestroyMethod_) /* throw (DependencyInjectionException) */
     {
-      if (preDestroyMethod != NULL)
-        throw DependencyInjectionException("Multiple preDestroy registrations detected for '%s'. \"There can be only one (pre instance).\"",this->toString().c_str());
+      if (methods->preDestroy != NULL)
+        DI_FAIL_DECLARATION("Multiple preDestroy registrations detected for '%s'. \"There can be only one (pre instance).\"",this->toString().c_str());
 
-      preDestroyMethod = preDestroyMethod_;
+      declared().preDestroy = preDestroyMethod_;
       return *this;
     }
 
     /**
-     * Returns the underlying instance.
+     * Calling this method instructs the context to call the warmUpMethod
+     *  on the Bean once every Bean has been postConstructed. See the section
+     *  on "Warm up" above.
      */
-    inline T* get() { return (T*)getConcrete(); }
-  };
-
-  // Still nothing to see here, move along ...
-  #include "internal/difactories.h"
-
-  /**
-   * A context defines the specific instance of a dependency injection container.
-   *  There is typically one per application but this is not a requirement if there
-   *  is a reason to have an application with multiple sub-eco-systems of 
-   *  interrelated implementations.
-   */
-  class Context
-  {
-    std::vector<internal::BeanBase*> instances;
-
-    void resetBeans();
-
-    enum Phase { initial = 0, started, stopped };
-    Phase curPhase;
-
-    friend class internal::FactoryBase;
-
-  public:
-
-    DI_INLINE internal::BeanBase* find(const internal::InstanceBase& typeInfo,const char* id = NULL, bool exact = true);
-
-    DI_INLINE void findAll(std::vector<internal::BeanBase*>& ret, const internal::InstanceBase& typeInfo,const char* id = NULL, bool exact = true);
-
-    DI_INLINE virtual ~Context() { clear(); }
+    inline Bean<T>& warmUp(WarmUpMethod warmUpMethod_) /* throw (DependencyInjectionException) */
+    {
+      if (methods->warmUp != NULL)
+        DI_FAIL_DECLARATION("Multiple warmUp registrations detected for '%s'. \"There can be only one (per instance).\"",this->toString().c_str());
 
-    inline Context() : curPhase(initial) {}
+      declared().warmUp = warmUpMethod_;
+      return *this;
+    }
 
     /**
-     * Use this method to declare that the context has an instance of a 
-     * particular type. The instance will be created using the default 
-     * constructor during the start call.
+     * Declares that this instance's state can be saved by Context::checkpoint and
+     *  restored by a later start, in place of it's postConstruct, rather than 
+     *  being worked out again. This is for instances that spend their 
+     *  postConstruct building something (an index, a table ...) that comes out 
+     *  the same every time.
+     *
+     * 'saveMethod' appends the state to the string it's given. 'restoreMethod' is
+     *  given what was saved, unless the declaration has changed since, and returns
+     *  false if it can't use it, in which case it's postConstructed as usual. 
+     *  The data stays valid until the context stops so the instance can use it 
+     *  in place rather than copying it.
+     *
+     * Only the instances created by start are restored.
      */
-    template<typename T> inline Bean<T>& has(const Instance<T>& bean) 
-    { 
-      Bean<T>* newBean = new Bean<T>(new internal::Factory0<T>,bean.getId());
-      instances.push_back(newBean);
-      return *newBean;
+    inline Bean<T>& checkpointed(SaveMethod saveMethod_, RestoreMethod restoreMethod_) /* throw (DependencyInjectionException) */
+    {
+      if (prototypeScope)
+        DI_FAIL_DECLARATION("\"%s\" is a prototype and can't also be checkpointed.",this->toString().c_str());
+      if (methods->save != NULL)
+        DI_FAIL_DECLARATION("Multiple checkpointed registrations detected for '%s'. \"There can be only one (per instance).\"",this->toString().c_str());
+
+      declared().save = saveMethod_;
+      methods->restore = restoreMethod_;
+      return *this;
     }
 
     /**
-     * Use this method to declare that the context has an instance of a 
-     * particular type with a given id. The instance will be created using the default 
-     * constructor prior to the method returning. (It is possible this
-     * may change in a future implementation so please don't write code
-     * that either expects this to be the case, or expects this not to
-     * be the case).
+     * Declares that this is a prototype rather than a singleton. Rather than one 
+     *  instance being created during start, a new instance is created, wired and 
+     *  postConstructed each time one is acquired from the context (see Context::acquire).
+     *
+     * Released instances are kept for reuse, up to maxPooled of them, after the 
+     *  (optional) reset method has been called on them. Instances that don't fit 
+     *  in the pool are preDestroyed and deleted.
+     *
+     * A prototype cannot be injected into other instances as a requirement. 
      */
-    template<typename T> inline Bean<T>& has(const char* id, const Instance<T>& bean)
-    { 
-      Bean<T>* newBean = new Bean<T>(new internal::Factory0<T>,id);
-      instances.push_back(newBean);
-      return *newBean;
+    inline Bean<T>& pooled(size_t maxPooled, ResetMethod resetMethod_ = NULL)
+    {
+      if (pool != NULL)
+        DI_FAIL_DECLARATION("\"%s\" was declared a prototype more than once.",this->toString().c_str());
+      if (factory->isAdopted())
+        DI_FAIL_DECLARATION("\"%s\" is an existing instance and can't be a prototype.",this->toString().c_str());
+      if (lazyScope)
+        DI_FAIL_DECLARATION("\"%s\" is lazy and can't also be a prototype.",this->toString().c_str());
+      if (replicaCount)
+        DI_FAIL_DECLARATION("\"%s\" is replicated and can't also be a prototype.",this->toString().c_str());
+      if (decorators)
+        DI_FAIL_DECLARATION("\"%s\" is decorated and can't also be a prototype.",this->toString().c_str());
+      if (swapCell)
+        DI_FAIL_DECLARATION("\"%s\" is swappable and can't also be a prototype.",this->toString().c_str());
+      if (methods->save != NULL)
+        DI_FAIL_DECLARATION("\"%s\" is checkpointed and can't also be a prototype.",this->toString().c_str());
+
+      pool = new internal::Pool(maxPooled);
+      if (resetMethod_ != NULL)
+        declared().reset = resetMethod_;
+      prototypeScope = true;
+      return *this;
     }
 
+    /**
+     * Declares that this is a prototype whose instances are never reused. This is 
+     *  the same as 'pooled(0)'.
+     */
+    inline Bean<T>& prototype() { return pooled(0); }
 
     /**
-     * This template method creates an instance that uses constructor injection.
-     * This form assumes that constructor of the object "T" takes one parameter.
-     * The parameter is identified by P1 which can be either:
-     *
-     *  1) A reference to another instance using the di::Ref class template.
-     *  2) A constant value using the di::Constant class template.
-     *
-     * Anything else passed will create a compile error.
+     * Declares that this instance isn't created during start but rather the first 
+     *  time it's needed: from a Provider (see di::Provider) or Context::get. Since
+     *  it doesn't exist during start it can only be injected using a Provider.
      */
-    template<typename T, typename P1> inline Bean<T>& has(const Instance<T>& bean, const P1& p1)
-    { 
-      Bean<T>* newBean = new Bean<T>(new internal::Factory1<T,P1>(p1),bean.getId());
-      instances.push_back(newBean);
-      return *newBean;
+    inline Bean<T>& lazy()
+    {
+      if (prototypeScope)
+        DI_FAIL_DECLARATION("\"%s\" is a prototype and can't also be lazy.",this->toString().c_str());
+      if (replicaCount)
+        DI_FAIL_DECLARATION("\"%s\" is replicated and can't also be lazy.",this->toString().c_str());
+      lazyScope = true;
+      return *this;
     }
 
     /**
-     * This template method creates an instance that uses constructor injection.
-     * This form assumes that constructor of the object "T" takes two parameter.
-     * The parameter is identified by P? which can be either:
-     *
-     *  1) A reference to another instance using the di::Ref class template.
-     *  2) A constant value using the di::Constant class template.
+     * Declares that rather than one instance there are 'count' of them (one per 
+     *  hardware thread when it's 0), each on it's own cache lines. Every replica is
+     *  constructed, wired and postConstructed the same way. This is for instances 
+     *  that are written to from many threads at once (counters, statistics, free 
+     *  lists) where sharing one instance would have the threads fighting over it's
+     *  cache lines.
      *
-     * Anything else passed will create a compile error.
+     * A replicated instance can only be injected using a Replicas (see di::Replicas).
+     *  Context::get returns the calling thread's replica.
      */
-    template<typename T, typename P1, typename P2> inline Bean<T>& has(const Instance<T>& bean, const P1& p1, const P2& p2)
-    { 
-      Bean<T>* newBean = new Bean<T>(new internal::Factory2<T,P1,P2>(p1,p2), bean.getId());
-      instances.push_back(newBean);
-      return *newBean;
+    inline Bean<T>& replicated(unsigned int count = 0)
+    {
+      if (replicaCount)
+        DI_FAIL_DECLARATION("\"%s\" was declared replicated more than once.",this->toString().c_str());
+      if (factory->isAdopted())
+        DI_FAIL_DECLARATION("\"%s\" is an existing instance and can't be replicated.",this->toString().c_str());
+      if (prototypeScope)
+        DI_FAIL_DECLARATION("\"%s\" is a prototype and can't also be replicated.",this->toString().c_str());
+      if (lazyScope)
+        DI_FAIL_DECLARATION("\"%s\" is lazy and can't also be replicated.",this->toString().c_str());
+      if (decorators)
+        DI_FAIL_DECLARATION("\"%s\" is decorated and can't also be replicated.",this->toString().c_str());
+      if (swapCell)
+        DI_FAIL_DECLARATION("\"%s\" is swappable and can't also be replicated.",this->toString().c_str());
+
+      if (count == 0)
+        count = std::thread::hardware_concurrency();
+      replicaCount = count == 0 ? 1 : count;
+      return *this;
     }
 
     /**
-     * This template method creates an instance that uses constructor injection.
-     * This form assumes that constructor of the object "T" takes two parameter.
-     * The parameter is identified by P? which can be either:
+     * Declares that the program itself needs this instance, rather than it only 
+     *  being there for other instances to use. Once anything in a context is a root,
+     *  start only creates the roots and what they depend on (through constructors,
+     *  requires, requiresAll and Providers). Everything else stays declared but 
+     *  dormant: it's not created, wired or postConstructed. This lets a program use 
+     *  part of a module that declares more than it needs.
+     */
+    inline Bean<T>& root()
+    {
+      rootScope = true;
+      return *this;
+    }
+
+    /**
+     * Declares that this instance belongs to a process (it owns threads, file 
+     *  descriptors, a connection ...) so it can't be shared with processes forked
+     *  after the context is started. Start leaves it, and anything that depends on 
+     *  it, for 'Context::onForked' to create in each child process. Everything else
+     *  is created before the fork and shared.
+     */
+    inline Bean<T>& afterFork()
+    {
+      afterForkScope = true;
+      return *this;
+    }
+
+    /**
+     * Declares that this instance does something outside of the process when it's
+     *  preDestroyed or deleted (flushes a file, closes a connection politely) that
+     *  has to happen even when the process is exiting. See Context::stopForExit.
+     */
+    inline Bean<T>& sideEffects()
+    {
+      sideEffectsScope = true;
+      return *this;
+    }
+
+    /**
+     * Declares that this instance can be replaced while the context is started 
+     *  (see Context::replace) without restarting what depends on it. It's injected
+     *  using a Swappable (see di::Swappable), which always finds the current 
+     *  instance, rather than as a pointer.
+     *
+     * Prototypes, replicated, decorated and existing instances can't be swappable.
+     */
+    inline Bean<T>& swappable()
+    {
+      if (swapCell)
+        DI_FAIL_DECLARATION("\"%s\" was declared swappable more than once.",this->toString().c_str());
+      if (factory->isAdopted())
+        DI_FAIL_DECLARATION("\"%s\" is an existing instance and can't be swappable.",this->toString().c_str());
+      if (prototypeScope || replicaCount || decorators)
+        DI_FAIL_DECLARATION("\"%s\" is a prototype, replicated or decorated and can't be swappable.",this->toString().c_str());
+
+      swapCell = new internal::SwapCell;
+      return *this;
+    }
+
+    /**
+     * Declares a decorator for the interface I: wherever this instance is injected
+     *  as an I (as a requirement, a constructor parameter or from a Provider) what's
+     *  injected is a D that was constructed with the instance itself ('D(I*)'). D 
+     *  is typically a class that implements I by timing or counting the calls and 
+     *  passing them on. The instance has to be (or becomes, see 'isAlso') an I.
+     *
+     *   context.has(Instance<Foo>()).isAlso(Instance<IFoo>()).decorate<IFoo>(Instance<TimingFoo>());
+     *
+     * Each decorator of the same interface wraps the one declared before it. The 
+     *  instance is still injected undecorated where it's required as anything else,
+     *  including it's own type, and Context::get returns it undecorated.
+     *
+     * Decorators are created after the instance and deleted before it. Prototypes 
+     *  and replicated instances can't be decorated.
+     */
+    template<typename I, typename D> inline Bean<T>& decorate(const Instance<D>& /*decorator*/) /* throw (DependencyInjectionException) */
+    {
+      if (prototypeScope || replicaCount || swapCell)
+        DI_FAIL_DECLARATION("\"%s\" is a prototype, replicated or swappable and can't be decorated.",this->toString().c_str());
+      if (!canConvertTo(Instance<I>()))
+        isAlso(Instance<I>());
+      addDecorator(new internal::Decorator<I,D>());
+      return *this;
+    }
+
+    /**
+     * The same as the above when 'enabled' is true. When it's false only the 'isAlso'
+     *  is declared and nothing about D is even compiled, so the instance is injected
+     *  exactly as though it was never decorated. This allows instrumentation to be
+     *  left in the declarations and switched with a compile time constant:
+     *
+     *   static constexpr bool tracing = TRACING_ENABLED;
+     *   context.has(Instance<Foo>()).isAlso(Instance<IFoo>()).decorate<IFoo,TimingFoo,tracing>();
+     */
+    template<typename I, typename D, bool enabled> inline Bean<T>& decorate() /* throw (DependencyInjectionException) */
+    {
+      return decorateIf<I,D>(std::integral_constant<bool,enabled>());
+    }
+
+  private:
+    template<typename I, typename D> inline Bean<T>& decorateIf(std::true_type) { return decorate<I>(Instance<D>()); }
+    template<typename I, typename D> inline Bean<T>& decorateIf(std::false_type) { return canConvertTo(Instance<I>()) ? *this : isAlso(Instance<I>()); }
+
+  public:
+    /**
+     * Returns the underlying instance. This is NULL for prototypes and the calling 
+     *  thread's replica for replicated instances.
+     */
+    inline T* get() { return (T*)getConcrete(); }
+  };
+
+  /**
+   * An instance acquired from a prototype (see Bean<T>::pooled). The instance is 
+   *  released back to it's Bean when the Lease goes away, or when 'release' is called.
+   *
+   * Leases can be moved but not copied. All leases need to be released before the 
+   *  Context they came from is cleared.
+   */
+  template<class T> class Lease
+  {
+    friend class Context;
+    friend class Provider<T>;
+
+    Bean<T>* bean;
+    T* instance;
+
+    Lease(const Lease&);
+    Lease& operator=(const Lease&);
+
+    inline Lease(Bean<T>* b, T* i) : bean(b), instance(i) {}
+
+  public:
+    inline Lease() : bean(NULL), instance(NULL) {}
+    inline Lease(Lease&& o) : bean(o.bean), instance(o.instance) { o.bean = NULL; o.instance = NULL; }
+    inline ~Lease() { release(); }
+
+    inline Lease& operator=(Lease&& o)
+    {
+      if (this != &o)
+      {
+        release();
+        bean = o.bean; instance = o.instance;
+        o.bean = NULL; o.instance = NULL;
+      }
+      return *this;
+    }
+
+    inline T* get() const { return instance; }
+    inline T* operator->() const { return instance; }
+    inline T& operator*() const { return *instance; }
+
+    /**
+     * Hands the instance back to it's prototype early. Leases on singletons (see
+     *  Provider) don't have a Bean and don't hand anything back.
+     */
+    inline void release()
+    {
+      if (bean != NULL && instance != NULL)
+        bean->releaseInstance(instance);
+      bean = NULL;
+      instance = NULL;
+    }
+  };
+
+  /**
+   * Something that can be injected in place of a dependency when the dependency
+   *  shouldn't (or can't) be looked up once and held onto. It's declared in a 
+   *  requires clause (or as a constructor parameter) and resolved by the context
+   *  once, when it's injected. 'get' then returns:
+   *
+   *  1) for a singleton, the instance (after the first call this is just a load).
+   *  2) for a lazy instance (see Bean<T>::lazy), the instance, creating it the
+   *     first time.
+   *  3) for a prototype, a new (or pooled) instance every time.
+   *
+   * 'get' returns a Lease in all cases so that prototype instances are handed back
+   *  when the caller is done with them. For singletons the Lease doesn't do anything
+   *  when it goes away.
+   *
+   *   class Foo
+   *   {
+   *     Provider<Buffer> buffers;
+   *   public:
+   *     void setBuffers(Provider<Buffer> b) { buffers = b; }
+   *     void parse() { Lease<Buffer> buffer = buffers.get(); ... }
+   *   };
+   *
+   *   context.has(Instance<Foo>()).requires(Instance<Buffer>(), &Foo::setBuffers);
+   *
+   * A Provider can be used as a constructor parameter the same way an Instance can:
+   *
+   *   context.has(Instance<Foo>(), Provider<Buffer>());
+   *
+   * Since a Provider doesn't need what it provides to exist yet, this is also a way
+   *  to break a cycle of constructor dependencies. Like any injected pointer, a 
+   *  Provider is only good while the context that resolved it is started.
+   */
+  template<class T> class Provider
+  {
+    Instance<T> required;
+    internal::BeanBase* bean;
+    Context* context;
+    mutable std::atomic<T*> instance;
+
+  public:
+    typedef Provider<T> type;
+
+    inline Provider() : bean(NULL), context(NULL), instance(NULL) {}
+    inline explicit Provider(const Instance<T>& required_) : required(required_), bean(NULL), context(NULL), instance(NULL) {}
+
+    inline Provider(const Provider& o) : required(o.required), bean(o.bean), context(o.context), instance(o.instance.load()) {}
+    inline Provider& operator=(const Provider& o) 
+    { 
+      required = o.required; bean = o.bean; context = o.context; instance = o.instance.load(); 
+      return *this;
+    }
+
+    /**
+     * Returns an instance of what this provides. See the class description.
+     */
+    inline Lease<T> get() const /* throw (DependencyInjectionException) */
+    {
+      T* ret = instance.load(std::memory_order_acquire);
+      return ret != NULL ? Lease<T>(NULL, ret) : provide();
+    }
+
+    /**
+     * Has the context resolved this Provider.
+     */
+    inline bool isResolved() const { return bean != NULL; }
+
+    inline const std::string toString() const { return std::string("Provider<").append(required.toString()).append(">"); }
+
+    /**
+     * The context uses these when the Provider is a constructor parameter.
+     */
+    inline bool available(Context* context_) const;
+    inline Provider<T> findIsAlso(Context* context_) const /* throw (DependencyInjectionException) */;
+    inline void addDependency(internal::Dependencies& ret) const { ret.push_back(internal::Dependency(required, internal::Dependency::provider)); }
+
+    /**
+     * Returns a Provider for the context's instance of 'required'. An exception is
+     *  thrown if there isn't exactly one.
+     */
+    static inline Provider<T> resolve(const Instance<T>& required, Context* context) /* throw (DependencyInjectionException) */;
+
+  private:
+    inline Lease<T> provide() const /* throw (DependencyInjectionException) */;
+  };
+
+  /**
+   * What a replicated instance (see Bean<T>::replicated) is injected as. It's 
+   *  declared the same way a Provider is, in a requires clause or as a constructor
+   *  parameter, and resolved by the context when it's injected:
+   *
+   *   class Requests
+   *   {
+   *     Replicas<Counter> counters;
+   *   public:
+   *     void setCounters(const Replicas<Counter>& c) { counters = c; }
+   *     void handle() { counters->increment(); ... }
+   *     long total() { return counters.aggregate(0L, [](long sum, const Counter& c) { return sum + c.count(); }); }
+   *   };
+   *
+   *   context.has(Instance<Counter>()).replicated();
+   *   context.has(Instance<Requests>()).requires(Instance<Counter>(), &Requests::setCounters);
+   *
+   * 'local' (and -> and *) return the calling thread's replica. Each thread is
+   *  handed a shard the first time it asks for one and threads are spread over the
+   *  shards round robin so, with as many replicas as there are cores, each 
+   *  replica is usually only written from one thread. Reading every replica to 
+   *  combine them (see 'aggregate') is left to the rare reader. There can be more
+   *  threads than replicas so a replica still needs to be safe to use from more 
+   *  than one thread (relaxed atomics for example). It's just rarely contended.
+   *
+   * Replicas<T> has to name the replicated type itself rather than something it 
+   *  isAlso since the replicas are found by their position in memory.
+   */
+  template<class T> class Replicas
+  {
+    Instance<T> required;
+    char* first;
+    size_t stride;
+    unsigned int count;
+
+  public:
+    typedef Replicas<T> type;
+
+    inline Replicas() : first(NULL), stride(0), count(0) {}
+    inline explicit Replicas(const Instance<T>& required_) : required(required_), first(NULL), stride(0), count(0) {}
+
+    /**
+     * The calling thread's replica.
+     */
+    inline T* local() const { return (T*)(first + stride * (internal::threadShard() % count)); }
+    inline T* operator->() const { return local(); }
+    inline T& operator*() const { return *local(); }
+
+    inline T& operator[](unsigned int i) const { return *(T*)(first + stride * i); }
+    inline unsigned int size() const { return count; }
+
+    /**
+     * Combines the replicas: 'combine(combine(initial, replica0), replica1)' and
+     *  so on. The other threads may be changing them while this reads them.
+     */
+    template<class R, class F> inline R aggregate(R initial, F combine) const
+    {
+      for (unsigned int i = 0; i < count; i++)
+        initial = combine(initial, (const T&)(*this)[i]);
+      return initial;
+    }
+
+    /**
+     * Has the context resolved this.
+     */
+    inline bool isResolved() const { return first != NULL; }
+
+    inline const std::string toString() const { return std::string("Replicas<").append(required.toString()).append(">"); }
+
+    /**
+     * The context uses these when the Replicas is a constructor parameter.
+     */
+    inline bool available(Context* context_) const { return required.available(context_); }
+    inline Replicas<T> findIsAlso(Context* context_) const /* throw (DependencyInjectionException) */ { return resolve(required,context_); }
+    inline void addDependency(internal::Dependencies& ret) const { ret.push_back(internal::Dependency(required, internal::Dependency::replicas)); }
+
+    /**
+     * Returns the replicas of the context's instance of 'required'. An exception 
+     *  is thrown if there isn't exactly one or it isn't replicated.
+     */
+    static inline Replicas<T> resolve(const Instance<T>& required, Context* context) /* throw (DependencyInjectionException) */;
+  };
+
+  /**
+   * What a swappable instance (see Bean<T>::swappable) is injected as. It's 
+   *  declared the same way a Provider is, in a requires clause or as a constructor
+   *  parameter. Rather than holding onto the instance it finds the current one each
+   *  time it's used, so that Context::replace can swap in a new instance without
+   *  anything that depends on it being restarted:
+   *
+   *   class Router
+   *   {
+   *     Swappable<Routes> routes;
+   *   public:
+   *     void setRoutes(const Swappable<Routes>& r) { routes = r; }
+   *     void route(Request& request) { routes->lookup(request.path()); }
+   *   };
+   *
+   *   context.has(Instance<Routes>(), Instance<Config>()).swappable();
+   *   context.has(Instance<Router>()).requires(Instance<Routes>(), &Router::setRoutes);
+   *   ...
+   *   context.replace(Instance<Routes>());
+   *
+   * Using it (-> or 'get') returns a Ref that keeps the instance it found alive
+   *  for as long as the Ref is. With -> that's the rest of the expression. Finding
+   *  the instance doesn't lock or wait. A replaced instance is preDestroyed and 
+   *  deleted as soon as the last Ref that might have found it goes away, by 
+   *  whichever thread lets go of it, so Refs should be short lived. A T* taken 
+   *  from a Ref is only good for as long as the Ref, which is why the context 
+   *  won't hand out a plain T* to a swappable instance (see Context::get).
+   *
+   * Outside of an injected instance, 'resolve' finds the Swappable for one in the
+   *  context:
+   *
+   *   Swappable<Routes> routes = Swappable<Routes>::resolve(Instance<Routes>(), &context);
+   *
+   * Swappable<T> has to name the swappable type itself rather than something it
+   *  isAlso.
+   */
+  template<class T> class Swappable
+  {
+    Instance<T> required;
+    internal::SwapCell* cell;
+
+  public:
+    typedef Swappable<T> type;
+
+    /**
+     * The instance that was current when the Ref was made. It stays valid, even if
+     *  it's replaced, until the Ref goes away.
+     */
+    class Ref
+    {
+      internal::Reclaimer::Guard guard;
+      T* instance;
+
+      Ref& operator=(const Ref&);
+
+    public:
+      inline explicit Ref(const internal::SwapCell& c) : guard(c.reclaimer), instance((T*)c.current.load()) {}
+
+      inline T* get() const { return instance; }
+      inline T* operator->() const { return instance; }
+      inline T& operator*() const { return *instance; }
+    };
+
+    inline Swappable() : cell(NULL) {}
+    inline explicit Swappable(const Instance<T>& required_) : required(required_), cell(NULL) {}
+
+    inline Ref get() const { return Ref(*cell); }
+    inline Ref operator->() const { return Ref(*cell); }
+
+    /**
+     * Has the context resolved this.
+     */
+    inline bool isResolved() const { return cell != NULL; }
+
+    inline const std::string toString() const { return std::string("Swappable<").append(required.toString()).append(">"); }
+
+    /**
+     * The context uses these when the Swappable is a constructor parameter.
+     */
+    inline bool available(Context* context_) const { return required.available(context_); }
+    inline Swappable<T> findIsAlso(Context* context_) const /* throw (DependencyInjectionException) */ { return resolve(required,context_); }
+    inline void addDependency(internal::Dependencies& ret) const { ret.push_back(internal::Dependency(required, internal::Dependency::swappable)); }
+
+    /**
+     * Returns a Swappable for the context's instance of 'required'. An exception 
+     *  is thrown if there isn't exactly one or it isn't swappable.
+     */
+    static inline Swappable<T> resolve(const Instance<T>& required, Context* context) /* throw (DependencyInjectionException) */;
+  };
+
+  // Still nothing to see here, move along ...
+  #include "internal/difactories.h"
+  #include "internal/discan.h"
+  #include "internal/diregistry.h"
+  #include "internal/distage.h"
+  #include "internal/diplan.h"
+  #include "internal/disnapshot.h"
+  #include "internal/distats.h"
+
+  /**
+   * The 'has' clauses. These are shared by the Context (which registers each
+   *  declaration as it's made) and a Module (which collects them to be installed
+   *  into a Context all at once). 'D' needs a 'declare(internal::BeanBase*)'
+   *  that takes ownership of the new Bean.
+   */
+  template<class D> class Declarations
+  {
+    template<typename T> inline Bean<T>& adopt(const Instance<T>& bean, const std::shared_ptr<T>& existing)
+    {
+      Bean<T>* newBean = new Bean<T>(new internal::Adopted<T>(existing), bean.getId());
+      if (existing.get() == NULL)
+      {
+        DependencyInjectionException failure = internal::failure(Status::badDeclaration, newBean->toString(), std::string(),
+          "Cannot declare a NULL instance of \"%s\".", bean.toString().c_str());
+#if DI_EXCEPTIONS
+        delete newBean;
+        throw failure;
+#else
+        newBean->declarationFailed();
+#endif
+      }
+      static_cast<D*>(this)->declare(newBean);
+      return *newBean;
+    }
+
+  public:
+    /**
+     * Use this method to declare that the context has an instance of a 
+     * particular type. The instance will be created using the default 
+     * constructor during the start call.
+     */
+    template<typename T> inline Bean<T>& has(const Instance<T>& bean) 
+    { 
+      Bean<T>* newBean = new Bean<T>(new internal::Factory0<T>,bean.getId());
+      static_cast<D*>(this)->declare(newBean);
+      return *newBean;
+    }
+
+    /**
+     * Use this method to declare that the context has an instance of a 
+     * particular type with a given id. The instance will be created using the default 
+     * constructor prior to the method returning. (It is possible this
+     * may change in a future implementation so please don't write code
+     * that either expects this to be the case, or expects this not to
+     * be the case).
+     */
+    template<typename T> inline Bean<T>& has(const Id& id, const Instance<T>& /*bean*/)
+    { 
+      Bean<T>* newBean = new Bean<T>(new internal::Factory0<T>,id.symbol());
+      static_cast<D*>(this)->declare(newBean);
+      return *newBean;
+    }
+
+    /**
+     * Use this method to declare an instance that already exists (a memory mapped
+     * table, something from another library's pool ...). It takes part in the 
+     * context like any other instance (requirements, postConstruct, etc.) but the 
+     * context doesn't own it. It must outlive the context, or at least any use of 
+     * the context after the context is cleared.
+     */
+    template<typename T> inline Bean<T>& has(const Instance<T>& bean, T* existing)
+    {
+      return adopt(bean, std::shared_ptr<T>(existing, internal::NoDelete<T>()));
+    }
+
+    /**
+     * Use this method to declare an instance that already exists and give the 
+     * context ownership of it. It's deleted (using the unique_ptr's deleter, so 
+     * this is also the way to supply a custom deleter) when the context is cleared
+     * or destroyed. Stopping the context doesn't delete it so that the context can
+     * be started again.
+     */
+    template<typename T, typename Deleter> inline Bean<T>& has(const Instance<T>& bean, std::unique_ptr<T,Deleter>&& existing)
+    {
+      return adopt(bean, std::shared_ptr<T>(std::move(existing)));
+    }
+
+    /**
+     * Use this method to declare an instance that already exists and that the
+     * context shares ownership of. The context's reference is let go of when the 
+     * context is cleared or destroyed.
+     */
+    template<typename T> inline Bean<T>& has(const Instance<T>& bean, const std::shared_ptr<T>& existing)
+    {
+      return adopt(bean, existing);
+    }
+
+    /**
+     * This template method creates an instance that uses constructor injection.
+     * This form assumes that constructor of the object "T" takes one parameter.
+     * The parameter is identified by P1 which can be either:
+     *
+     *  1) A reference to another instance using the di::Ref class template.
+     *  2) A constant value using the di::Constant class template.
+     *
+     * Anything else passed will create a compile error.
+     */
+    template<typename T, typename P1> inline Bean<T>& has(const Instance<T>& bean, const P1& p1)
+    { 
+      Bean<T>* newBean = new Bean<T>(new internal::Factory1<T,P1>(p1),bean.getId());
+      static_cast<D*>(this)->declare(newBean);
+      return *newBean;
+    }
+
+    /**
+     * This template method creates an instance that uses constructor injection.
+     * This form assumes that constructor of the object "T" takes two parameter.
+     * The parameter is identified by P? which can be either:
+     *
+     *  1) A reference to another instance using the di::Ref class template.
+     *  2) A constant value using the di::Constant class template.
+     *
+     * Anything else passed will create a compile error.
+     */
+    template<typename T, typename P1, typename P2> inline Bean<T>& has(const Instance<T>& bean, const P1& p1, const P2& p2)
+    { 
+      Bean<T>* newBean = new Bean<T>(new internal::Factory2<T,P1,P2>(p1,p2), bean.getId());
+      static_cast<D*>(this)->declare(newBean);
+      return *newBean;
+    }
+
+    /**
+     * This template method creates an instance that uses constructor injection.
+     * This form assumes that constructor of the object "T" takes two parameter.
+     * The parameter is identified by P? which can be either:
      *
      *  1) A reference to another instance using the di::Ref class template.
      *  2) A constant value using the di::Constant class template.
@@ -507,7 +1632,7 @@ namespace di
     inline Bean<T>& has(const Instance<T>& bean, const P1& p1, const P2& p2, const P3& p3)
     { 
       Bean<T>* newBean = new Bean<T>(new internal::Factory3<T,P1,P2,P3>(p1,p2,p3), bean.getId());
-      instances.push_back(newBean);
+      static_cast<D*>(this)->declare(newBean);
       return *newBean;
     }
 
@@ -525,9 +1650,240 @@ namespace di
     inline Bean<T>& has(const Instance<T>& bean, const P1& p1, const P2& p2, const P3& p3, const P4& p4)
     { 
       Bean<T>* newBean = new Bean<T>(new internal::Factory4<T,P1,P2,P3,P4>(p1,p2,p3,p4), bean.getId());
-      instances.push_back(newBean);
+      static_cast<D*>(this)->declare(newBean);
       return *newBean;
     }
+  };
+
+  /**
+   * A set of declarations that's built up separately and then installed into a
+   *  Context in one go. This is for wiring that's spread out across many parts of
+   *  an application where each part has a hand full (or hundreds) of 'has' clauses:
+   *
+   *   void declareStorage(Module& module)
+   *   {
+   *     module.has(Instance<Cache>()).requires(Instance<Disk>(), &Cache::setDisk);
+   *     module.has(Instance<Disk>("primary"));
+   *   }
+   *   ...
+   *   Module module;
+   *   declareStorage(module);
+   *   context.install(module);
+   *
+   * The declarations aren't visible to the Context until the module is installed.
+   *  Installing checks the whole module for ids that are declared more than once
+   *  (for the same type), in the module or already in the context, and then adds
+   *  all of them at once. A Module that's never installed deletes its declarations.
+   */
+  class Module : public Declarations<Module>, public internal::NoCopy
+  {
+    friend class Declarations<Module>;
+    friend class Context;
+
+    std::vector<internal::BeanBase*> beans;
+
+    inline void declare(internal::BeanBase* bean) { beans.push_back(bean); }
+
+  public:
+    inline Module() {}
+
+    /**
+     * 'expected' is how many declarations the module will likely have.
+     */
+    inline explicit Module(size_t expected) { beans.reserve(expected); }
+
+    inline ~Module()
+    {
+      for (std::vector<internal::BeanBase*>::iterator it = beans.begin(); it != beans.end(); it++)
+        delete (*it);
+    }
+
+    inline size_t size() const { return beans.size(); }
+    inline bool empty() const { return beans.empty(); }
+  };
+
+  /**
+   * A context defines the specific instance of a dependency injection container.
+   *  There is typically one per application but this is not a requirement if there
+   *  is a reason to have an application with multiple sub-eco-systems of 
+   *  interrelated implementations.
+   */
+  class Context : public Declarations<Context>
+  {
+    internal::Registry registry;
+
+    // what 'has' declares is staged by the declaring thread until something looks
+    //  at the registry (see 'publishStaged')
+    internal::Staging staging;
+    inline void declare(internal::BeanBase* bean) { staging.stage(bean); }
+    friend class Declarations<Context>;
+
+    /**
+     * Adds the calling thread's staged Beans, or every thread's, to the registry.
+     */
+    DI_INLINE void publishStaged(bool all);
+
+    void resetBeans();
+
+    enum Phase { initial = 0, started, stopped, starting };
+    std::atomic<Phase> curPhase;
+
+    // book keeping for startAsync/waitFor/progress
+    std::thread starter;
+    std::mutex readyLock;
+    std::condition_variable readyCondition;
+    std::atomic<unsigned int> numToStart; // what this start creates, once it's 'planned'
+    bool planned; // the start knows which instances it won't create, guarded by readyLock
+    std::atomic<unsigned int> numInstantiated;
+    std::atomic<unsigned int> numWired;
+    std::atomic<unsigned int> numPostConstructed;
+    std::atomic<unsigned int> numWarmedUp;
+
+  public:
+    /**
+     * The outcome of a single instance's warm up. See 'warmUpReport()'
+     */
+    struct WarmUpResult
+    {
+      enum Status { completed = 0, skipped, failed };
+
+      std::string bean;
+      Status status;
+      std::chrono::nanoseconds duration;
+    };
+
+  private:
+    std::chrono::nanoseconds warmUpBudget;
+    std::atomic<bool> warmUpCancelled;
+    std::chrono::steady_clock::time_point warmUpDeadline;
+    std::vector<WarmUpResult> warmUpResults;
+
+    // see setStartPlanFile
+    std::string planFile;
+    bool usedPlan;
+
+    // stopForExit was called so the instances that are left are abandoned
+    bool exited;
+
+    // compact was called so the declarations can't be started again
+    bool compacted;
+
+    // see setCheckpointFile. The checkpoint is open from the start that restored
+    //  from it until the restored instances are deleted.
+    std::string checkpointFile;
+    internal::Snapshot restoredFrom;
+    size_t numRestored;
+
+    // how long each instance took during the last start, by position
+    std::vector<internal::StartPlan::Step> lastTimings;
+
+    DI_INLINE void beginStart();
+    DI_INLINE void runStart();
+    DI_INLINE void doStart();
+    DI_INLINE void finishStart(bool succeeded);
+    DI_INLINE void abandonStart();
+    DI_INLINE void findDormant(const internal::Registry::View& beans);
+    DI_INLINE void findDeferred(const internal::Registry::View& beans);
+    DI_INLINE void startDeferred(const std::vector<internal::BeanBase*>& deferred, const std::vector<unsigned long long>& definitions);
+    DI_INLINE void markReady(internal::BeanBase* instance);
+
+    // what each checkpointed Bean's state is kept under (see Snapshot::key), by 
+    //  position. 0 for the others.
+    DI_INLINE void checkpointDefinitions(const internal::Registry::View& beans, std::vector<unsigned long long>& ret);
+    DI_INLINE void postConstructOrRestore(internal::BeanBase* instance, unsigned long long definition);
+    DI_INLINE void doWarmUp(std::vector<internal::StartPlan::Step>& byBean);
+    DI_INLINE void waitForStart();
+    DI_INLINE void joinStarter();
+
+    // the context whose start this thread is running (or warming up for), so that
+    //  it's callbacks fail rather than wait for the start they're part of.
+    static inline const Context*& startingOn() { static thread_local const Context* context = NULL; return context; }
+    struct Starting
+    {
+      const Context* previous;
+      inline explicit Starting(const Context* context) : previous(startingOn()) { startingOn() = context; }
+      inline ~Starting() { startingOn() = previous; }
+    };
+    DI_INLINE internal::BeanBase* waitForBean(const internal::InstanceBase& typeInfo, const Id& id);
+
+    // what's keeping 'bean' from being instantiated, for reporting
+    DI_INLINE std::string unsatisfiedDependency(internal::BeanBase* bean);
+
+    // runs 'f' and returns what went wrong, if anything. See the 'try' methods.
+    template<class F> inline Status attempt(F f)
+    {
+      internal::clearFailure();
+#if DI_EXCEPTIONS
+      try { f(); }
+      catch (DependencyInjectionException& ex) { return internal::caught(ex.getMessage()); }
+      catch (...) { return internal::caught("Unknown exception intercepted."); }
+      return Status();
+#else
+      f();
+      return internal::takeFailure();
+#endif
+    }
+
+    // serializes the creation of lazy instances
+    std::recursive_mutex lazyLock;
+    DI_INLINE void instantiateLazy(internal::BeanBase* bean);
+
+    // see 'stats()'
+    internal::Counters counters;
+
+    template<class T> friend class Provider;
+    template<class T> friend class Instance;
+    template<class T, class D, class RDT> friend class internal::Requirement;
+    template<class RDT> friend struct internal::CollectAll;
+
+    friend class internal::FactoryBase;
+
+  public:
+
+    /**
+     * A snapshot of how far along the startup lifecycle stages the context is.
+     *  Each count is out of 'total', which is every declared instance until a 
+     *  start works out which ones it creates. Lazy and dormant instances, and 
+     *  those left for onForked, aren't part of it.
+     */
+    struct Progress
+    {
+      unsigned int total;
+      unsigned int instantiated;
+      unsigned int wired;
+      unsigned int postConstructed;
+      unsigned int warmedUp;
+    };
+
+    /**
+     * Calls the visitor with each Bean that matches. The visitor is told up front
+     *  (via 'reserve') roughly how many there may be, and can return false from
+     *  'operator()' to stop early. This uses the type index when there is one.
+     */
+    template<class V> inline void visitAll(V& visitor, const internal::InstanceBase& typeInfo, internal::Symbol id = NULL, bool exact = true);
+
+    DI_INLINE internal::BeanBase* find(const internal::InstanceBase& typeInfo,const Id& id = Id(), bool exact = true);
+
+    DI_INLINE void findAll(std::vector<internal::BeanBase*>& ret, const internal::InstanceBase& typeInfo,const Id& id = Id(), bool exact = true);
+
+    DI_INLINE virtual ~Context() { clear(); }
+
+    /**
+     * Adds every declaration in the module to the context. Afterward the module
+     *  is empty (the context owns what was declared in it) and can be reused.
+     *  If any id is declared more than once for the same type this throws and
+     *  nothing is added.
+     */
+    DI_INLINE void install(Module& module) /* throw (DependencyInjectionException) */;
+
+    /**
+     * The same as 'install' but returns what went wrong rather than throwing.
+     */
+    inline Status tryInstall(Module& module) { return attempt([this, &module]() { install(module); }); }
+
+    inline Context() : curPhase(initial), numToStart(0), planned(false), numInstantiated(0), numWired(0), numPostConstructed(0), 
+      numWarmedUp(0), warmUpBudget(0), warmUpCancelled(false), usedPlan(false), exited(false), compacted(false), numRestored(0) {}
+
 
     template<typename T>
     inline void staticMethodRequirement( void (*staticSetter)(T* instance) )
@@ -544,6 +1900,8 @@ namespace di
      * 2) Wiring - satisfying of the requirements via calling the identified setters
      * 3) Post Construction - which calls all of the postConstruct methods that
      *    were declared to the context.
+     * 4) Warm Up - which calls all of the warmUp methods that were declared to
+     *    the context, concurrently and within the warm up budget.
      *
      * A failure to start (indicated by an exception) will automatically reset the
      * instances. Therefore it is possible that the instances constructors and 
@@ -551,6 +1909,208 @@ namespace di
      */
     DI_INLINE void start() /* throw (DependencyInjectionException) */;
 
+    /**
+     * This runs the same lifecycle stages as 'start()' but does so on a background
+     *  thread. The returned future completes when the context is started, or holds
+     *  the DependencyInjectionException that start would have thrown.
+     *
+     * The context must not be modified while the start is in progress. Calling stop()
+     *  (or clear(), or destroying the context) will wait for it to complete first.
+     */
+    DI_INLINE std::future<void> startAsync() /* throw (DependencyInjectionException) */;
+
+    /**
+     * The same as 'start()' but rather than throwing it returns a Status that says
+     *  what kind of failure it was, which instance it was starting and, if that's
+     *  why it failed, which of that instance's requirements couldn't be met. This 
+     *  is how to start a context in code built without exceptions.
+     */
+    inline Status tryStart() { return attempt([this]() { start(); }); }
+
+    /**
+     * Returns the current progress of a start (or startAsync) through the startup 
+     *  lifecycle stages. This can be called from any thread.
+     */
+    DI_INLINE Progress progress();
+
+    /**
+     * Counts of what a context has been asked to do since stats were enabled (see
+     *  'enableStats'). Each count only ever goes up.
+     */
+    struct Stats
+    {
+      bool enabled;
+      unsigned long long finds; // lookups for a single instance (get, find, injection)
+      unsigned long long findAlls; // lookups for every matching instance
+      unsigned long long candidatesScanned; // instances looked at by both kinds of lookup
+      unsigned long long conversions; // dynamic_casts to the type that was asked for
+      unsigned long long lazyCreated; // lazy instances created
+      unsigned long long acquired; // prototype instances handed out (including pooled ones)
+      unsigned long long declared; // instances declared to the context right now
+      Progress progress; // where the lifecycle is (see 'progress()')
+    };
+
+    /**
+     * Turns the counters returned by 'stats()' on or off. They're off by default.
+     *  When they're on each lookup costs an extra uncontended atomic add or two.
+     *  Turning them off doesn't reset them.
+     */
+    inline void enableStats(bool on = true) { counters.enable(on); }
+
+    /**
+     * Returns a snapshot of the counters. This can be called from any thread. The 
+     *  counts are each accurate but, while other threads are busy, not necessarily
+     *  all from the same instant.
+     */
+    DI_INLINE Stats stats();
+
+    /**
+     * A breakdown of the memory used by a context. See 'memoryReport()'
+     */
+    struct MemoryReport
+    {
+      size_t beans;         // number of declared instances
+      size_t instances;     // number of those currently instantiated
+      size_t metadataBytes; // the declarations: Beans, factories, requirements, ids
+      size_t registryBytes; // the context's lists and indexes of the declarations
+      size_t instanceBytes; // sizeof each instantiated instance (shallow)
+    };
+
+    /**
+     * Reports the memory used by the context, split between the declarations
+     *  and the instances. Instance sizes are shallow, what they allocate themselves
+     *  isn't visible to the context.
+     */
+    DI_INLINE MemoryReport memoryReport();
+
+    /**
+     * Who depends on who. See 'dependencyGraph()'
+     */
+    struct DependencyGraph
+    {
+      struct Node
+      {
+        std::string name;
+        std::vector<std::string> provides; // the types it's declared as (see Bean<T>::isAlso)
+        bool prototype;
+        bool lazy;
+        std::chrono::nanoseconds cost; // to instantiate and postConstruct
+      };
+
+      struct Edge
+      {
+        enum Kind { constructor = 0, setter, all, provider, replicas, swappable };
+
+        size_t from; // the node that depends on ...
+        size_t to;   // ... this one
+        Kind kind;
+        std::string required; // what 'from' asked for, which 'to' provides
+      };
+
+      std::vector<Node> nodes;
+      std::vector<Edge> edges;
+
+      /**
+       * The chain of dependencies (from the first to be constructed to the last) 
+       *  with the largest total cost, and that total. However many threads a start 
+       *  could use, it can't take less time than this. Provider edges aren't part 
+       *  of it since what's provided doesn't have to exist first. If there are 
+       *  cycles (possible with setter injection) an edge that closes one is ignored.
+       */
+      std::vector<size_t> criticalPath;
+      std::chrono::nanoseconds criticalPathCost;
+
+      /**
+       * Recalculates the critical path after the nodes' costs are changed.
+       */
+      DI_INLINE void findCriticalPath();
+
+      /**
+       * The graph in Graphviz's dot format with the critical path in bold.
+       */
+      DI_INLINE std::string toDot() const;
+
+      DI_INLINE std::string toJson() const;
+    };
+
+    /**
+     * Builds the graph of declared instances and the dependencies between them: 
+     *  constructor parameters, requires clauses (including requiresAll and Providers)
+     *  resolved the way the context would resolve them, isAlso included. The cost 
+     *  of each is from the last start, or zero if there hasn't been one.
+     */
+    DI_INLINE DependencyGraph dependencyGraph();
+
+  private:
+    // the edges of the graph between 'beans', by position (see 'dependencyGraph()')
+    DI_INLINE void dependencyEdges(const internal::Registry::View& beans, std::vector<DependencyGraph::Edge>& ret);
+
+  public:
+
+    /**
+     * Limits how long the warm up stage of 'start()' is allowed to take. No warm up 
+     *  method is started once the budget is spent. A zero budget (the default) means
+     *  there's no limit.
+     */
+    template<class Rep, class Period> inline void setWarmUpBudget(const std::chrono::duration<Rep,Period>& budget)
+    {
+      warmUpBudget = std::chrono::duration_cast<std::chrono::nanoseconds>(budget);
+    }
+
+    /**
+     * Warm up methods that take a while should poll this and return early once it's
+     *  true. It becomes true when the warm up budget is spent or 'stop()' is called.
+     */
+    DI_INLINE bool isWarmUpCancelled();
+
+    /**
+     * Returns how the warm up stage went for each instance that registered a warm up
+     *  method during the last start.
+     */
+    inline const std::vector<WarmUpResult>& warmUpReport() const { return warmUpResults; }
+
+    /**
+     * Remembers how the context started, in the file at 'path', so that the next
+     *  start (usually in the next run of the process) can skip working out the 
+     *  instantiation order and can start the warm ups heading the slowest chains
+     *  (through what depends on them) first. The file
+     *  is keyed on a hash of the declarations so if they've changed in any way
+     *  it's ignored and the start works everything out again. It's rewritten after
+     *  every successful start.
+     */
+    inline void setStartPlanFile(const std::string& path) { planFile = path; }
+
+    /**
+     * Whether the last start used the plan saved by the one before it.
+     */
+    inline bool startedFromPlan() const { return usedPlan; }
+
+    /**
+     * Saves the state of the checkpointed instances (see Bean<T>::checkpointed) to
+     *  the file at 'path'. A later start, usually in the next run of the process,
+     *  that's been given the file (see setCheckpointFile) restores them from it 
+     *  rather than postConstructing them. The file replaces any that's there
+     *  once it's completely written.
+     */
+    DI_INLINE void checkpoint(const std::string& path) /* throw (DependencyInjectionException) */;
+
+    /**
+     * The same as 'checkpoint' but returns what went wrong rather than throwing.
+     */
+    inline Status tryCheckpoint(const std::string& path) { return attempt([this, &path]() { checkpoint(path); }); }
+
+    /**
+     * Where start looks for a checkpoint (see 'checkpoint') to restore from. A 
+     *  missing file, or one saved for different declarations, just means the 
+     *  instances are postConstructed as usual.
+     */
+    inline void setCheckpointFile(const std::string& path) { checkpointFile = path; }
+
+    /**
+     * How many instances the last start restored from a checkpoint.
+     */
+    inline size_t instancesRestored() const { return numRestored; }
+
     /**
      * progress through the stop/shutdown lifecycle stages. These include,
      *   in order:
@@ -559,9 +2119,67 @@ namespace di
      *    were declared to the context.
      * 2) Deletion - Deletes all of the instances that were instantiated 
      *    during the Instantiation lifecycle stage.
+     *
+     * If a start is in progress on another thread it's warm up stage is cancelled and
+     *  this waits for it to finish before stopping.
      */
     DI_INLINE void stop() /* throw (DependencyInjectionException) */;
 
+    /**
+     * The same as 'stop()' but returns what went wrong rather than throwing.
+     */
+    inline Status tryStop() { return attempt([this]() { stop(); }); }
+
+    /**
+     * A stop for when the process is about to exit. Only the instances declared
+     *  with side effects (see Bean<T>::sideEffects) are preDestroyed and deleted,
+     *  in the same order 'stop()' would. Everything else, including the context's
+     *  own book keeping, is left for the operating system to reclaim along with
+     *  the rest of the process, so this takes as long as the instances that need 
+     *  cleaning up take. If one of their preDestroy methods fails the others are
+     *  still cleaned up and the first failure is reported once they have been.
+     *
+     * The context can't be started again afterwards and clearing or destroying it
+     *  doesn't delete anything more.
+     */
+    DI_INLINE void stopForExit() /* throw (DependencyInjectionException) */;
+
+    /**
+     * For a server that starts the context and then forks worker processes. Call
+     *  this in each child process after the fork to instantiate, wire and 
+     *  postConstruct the instances that start left out because they're per process
+     *  (see Bean<T>::afterFork). They're wired against the instances the child 
+     *  inherited from the parent.
+     *
+     * If this fails the instances it created are deleted again and the child is 
+     *  left as it was right after the fork.
+     */
+    DI_INLINE void onForked() /* throw (DependencyInjectionException) */;
+
+    inline Status tryOnForked() { return attempt([this]() { onForked(); }); }
+
+    inline Status tryStopForExit() { return attempt([this]() { stopForExit(); }); }
+
+    /**
+     * Frees the parts of the declarations that are only needed to create and wire
+     *  the instances, once start has done that: the factories, along with the 
+     *  constants they hold for the constructors, and the requirements. What 'get',
+     *  the other lookups and 'stop()' need is kept, as is everything about the 
+     *  instances that can still be created or wired (prototypes, lazy instances 
+     *  that haven't been needed yet, swappable and afterFork instances) or 
+     *  checkpointed.
+     *
+     * The declarations can't be started again afterwards, 'clear()' the context
+     *  to declare them again. The memory report and dependency graph only cover 
+     *  what's left.
+     */
+    DI_INLINE void compact() /* throw (DependencyInjectionException) */;
+
+    /**
+     * The same as 'compact' but returns what went wrong rather than throwing.
+     */
+    inline Status tryCompact() { return attempt([this]() { compact(); }); }
+
     /**
      * clear() will reset the Context to it's initial state prior to any instances
      * even being added. It clears all Beans from the context, first invoking
@@ -574,15 +2192,131 @@ namespace di
     /**
      * Allows retrieving an object by its type and Id. If there is more than
      *  one instance that is of this type, it will simply return the
-     *  first one it finds in the context.
+     *  first one it finds in the context. A lazy instance (see Bean<T>::lazy)
+     *  is created if it hasn't been yet.
+     *
+     * Other than creating a lazy instance this never blocks and is safe to call 
+     *  while other threads are adding instances to the context.
+     *
+     * A swappable instance (see Bean<T>::swappable) can't be gotten this way since
+     *  nothing would keep it alive once it's replaced. An exception is thrown and
+     *  it has to be used through a Swappable instead (see Swappable<T>::resolve).
      */
-    template<typename T> inline T* get(const Instance<T>& typeToFind, const char* id = NULL) 
+    template<typename T> inline T* get(const Instance<T>& typeToFind, const Id& id = Id()) 
     { 
+      internal::Registry::View pin = registry.view();
       internal::BeanBase* ret = find(typeToFind,id); 
+      if (ret != NULL && ret->isLazy())
+      {
+        instantiateLazy(ret);
+        DI_PROPAGATE(NULL);
+      }
+      if (ret != NULL && ret->isSwappable())
+        DI_FAIL(NULL, Status::notInjectable, ret->toString(), typeToFind.toString(), "\"%s\" is swappable and must be used through a Swappable.", ret->toString().c_str());
       
       return ret != NULL ? ((Bean<T>*)ret)->get() : NULL;
     }
 
+    /**
+     * The same as 'get' but it also says why there's nothing to get: there's no 
+     *  such instance (notFound), it's a prototype (notInjectable), it hasn't been
+     *  created yet (wrongPhase) or creating a lazy one failed. 'found' is set to
+     *  the instance, or NULL.
+     */
+    template<typename T> inline Status tryGet(const Instance<T>& typeToFind, T*& found, const Id& id = Id())
+    {
+      found = NULL;
+      Status ret = attempt([&]() { found = get(typeToFind,id); });
+      if (!ret.isOk() || found != NULL)
+        return ret;
+
+      internal::BeanBase* bean = find(typeToFind,id);
+      if (bean == NULL)
+        return Status(Status::notFound, typeToFind.toString(), std::string(), "There's no \"" + typeToFind.toString() + "\" in the context.");
+      if (bean->isPrototype())
+        return Status(Status::notInjectable, bean->toString(), std::string(), "\"" + bean->toString() + "\" is a prototype and must be acquired.");
+      return Status(Status::wrongPhase, bean->toString(), std::string(), "\"" + bean->toString() + "\" hasn't been instantiated.");
+    }
+
+    /**
+     * Blocks until the identified instance has been postConstructed during a start
+     *  (typically one kicked off with 'startAsync') and returns it. An exception is
+     *  thrown if there is no such instance, if the context isn't starting, if the 
+     *  start fails before the instance is ready, or if it's swappable (see 'get').
+     *  A lazy or dormant instance, or one left for onForked, is never created by
+     *  the start so rather than waiting it fails with Status::notCreated.
+     */
+    template<typename T> inline T* waitFor(const Instance<T>& typeToFind, const Id& id = Id()) /* throw (DependencyInjectionException) */
+    {
+      internal::BeanBase* ready = waitForBean(typeToFind,id);
+      if (ready != NULL && ready->isSwappable())
+        DI_FAIL(NULL, Status::notInjectable, ready->toString(), typeToFind.toString(), "\"%s\" is swappable and must be used through a Swappable.", ready->toString().c_str());
+      return ready != NULL ? ((Bean<T>*)ready)->get() : NULL;
+    }
+
+    /**
+     * The same as 'waitFor' but returns why there's nothing to wait for rather 
+     *  than throwing. 'found' is set to the instance, or NULL.
+     */
+    template<typename T> inline Status tryWaitFor(const Instance<T>& typeToFind, T*& found, const Id& id = Id())
+    {
+      found = NULL;
+      return attempt([&]() { found = waitFor(typeToFind,id); });
+    }
+
+    /**
+     * Acquires an instance of a prototype (see Bean<T>::pooled). An exception is thrown
+     *  if there is no such prototype or the context hasn't been started.
+     */
+    template<typename T> inline Lease<T> acquire(const Instance<T>& typeToFind, const Id& id = Id()) /* throw (DependencyInjectionException) */
+    {
+      internal::Registry::View pin = registry.view();
+      internal::BeanBase* found = find(typeToFind,id);
+      DI_CLEAR_FAILURE();
+      if (found == NULL || !found->isPrototype())
+        DI_FAIL(Lease<T>(), Status::notFound, typeToFind.toString(), std::string(), "There's no prototype \"%s\" to acquire.", typeToFind.toString().c_str());
+      if (!found->instantiated())
+        DI_FAIL(Lease<T>(), Status::wrongPhase, found->toString(), std::string(), "Cannot acquire a \"%s\" until the context is started.", found->toString().c_str());
+
+      Bean<T>* bean = (Bean<T>*)found;
+      T* instance = bean->acquireInstance(this);
+      DI_PROPAGATE(Lease<T>());
+      counters.count(internal::Counters::acquired);
+      return Lease<T>(bean, instance);
+    }
+
+    /**
+     * Replaces a swappable instance (see Bean<T>::swappable) with a new one. The 
+     *  new instance is created, wired and postConstructed the same way the one 
+     *  it replaces was, from what's in the context now, and then published so that
+     *  every Swappable finds it from then on. The replaced instance is preDestroyed
+     *  and deleted once nothing is still using it (see di::Swappable). 
+     *
+     * If creating the new instance fails an exception is thrown and the current
+     *  instance stays. Replacements of the same instance are serialized but don't
+     *  hold up anything else.
+     */
+    template<typename T> inline void replace(const Instance<T>& typeToReplace, const Id& id = Id()) /* throw (DependencyInjectionException) */
+    {
+      internal::Registry::View pin = registry.view();
+      internal::BeanBase* found = find(typeToReplace,id);
+      DI_CLEAR_FAILURE();
+      if (found == NULL || !found->isSwappable())
+        DI_FAIL(, Status::notFound, typeToReplace.toString(), std::string(), "There's no swappable \"%s\" to replace.", typeToReplace.toString().c_str());
+      if (!isStarted() || !found->instantiated())
+        DI_FAIL(, Status::wrongPhase, found->toString(), std::string(), "Cannot replace \"%s\" unless the context is started and it's been created.", found->toString().c_str());
+
+      ((Bean<T>*)found)->replaceInstance(this);
+    }
+
+    /**
+     * The same as 'replace' but returns what went wrong rather than throwing.
+     */
+    template<typename T> inline Status tryReplace(const Instance<T>& typeToReplace, const Id& id = Id()) 
+    { 
+      return attempt([&]() { replace(typeToReplace,id); }); 
+    }
+
     /**
      * Is the Context stopped. This will be true prior to start or after stop 
      * is called.
@@ -593,6 +2327,11 @@ namespace di
      * isStarted() will be true once the 'start()' call succeeds.
      */
     inline bool isStarted() { return curPhase == started; }
+
+    /**
+     * isStarting() will be true while a 'start()' or 'startAsync()' is in progress.
+     */
+    inline bool isStarting() { return curPhase == starting; }
   };
 
   // Nothing to see here, move along ...
@@ -1,7 +1,7 @@
 #!/bin/sh
 
-#g++ -g -I../.. *.cpp ../*.cpp && ./a.out
+#g++ -g -pthread -I../.. *.cpp ../*.cpp && ./a.out
 
-g++ -g -DDI_HEADER_ONLY -I../.. *.cpp && ./a.out
+g++ -g -pthread -DDI_HEADER_ONLY -I../.. *.cpp && ./a.out
 
 
@@ -16,16 +16,147 @@
  *  non-internal API classes in "di.h".
  */
 class Context;
+class Module;
+template<class D> class Declarations;
 template<class T> class Bean;
+template<class T> class Lease;
+template<class T> class Provider;
+template<class T> class Replicas;
+template<class T> class Swappable;
 
 namespace internal
 {
   // This class is used to prevent copying ... it has no friends (awwww!)
-  class NoCopy { inline NoCopy(const NoCopy& o) {} public: inline NoCopy() {} };
+  class NoCopy { inline NoCopy(const NoCopy& /*o*/) {} public: inline NoCopy() {} };
+
+  /**
+   * A vector of pointers that keeps the first N of them inline and only goes to
+   *  the heap beyond that. Most Beans have one or two of each of the things they
+   *  keep lists of so this saves an allocation (and a pointer chase) per list.
+   */
+  template<class P, unsigned int N> class SmallVector : public NoCopy
+  {
+    P* items;
+    unsigned int count;
+    unsigned int capacity;
+    P inlineItems[N];
+
+  public:
+    typedef P* iterator;
+    typedef const P* const_iterator;
+
+    inline SmallVector() : items(inlineItems), count(0), capacity(N) {}
+    inline ~SmallVector() { if (items != inlineItems) delete [] items; }
+
+    inline void push_back(P item)
+    {
+      if (count == capacity)
+      {
+        P* grown = new P[capacity * 2];
+        for (unsigned int i = 0; i < count; i++)
+          grown[i] = items[i];
+        if (items != inlineItems)
+          delete [] items;
+        items = grown;
+        capacity *= 2;
+      }
+      items[count++] = item;
+    }
+
+    inline iterator begin() { return items; }
+    inline iterator end() { return items + count; }
+    inline const_iterator begin() const { return items; }
+    inline const_iterator end() const { return items + count; }
+    inline size_t size() const { return count; }
+    inline P operator[](size_t index) const { return items[index]; }
+
+    /**
+     * Empties it and gives back the heap it was using, if any.
+     */
+    inline void clear() { if (items != inlineItems) delete [] items; items = inlineItems; count = 0; capacity = N; }
+
+    /**
+     * How many bytes this uses beyond sizeof(SmallVector).
+     */
+    inline size_t heapBytes() const { return items == inlineItems ? 0 : capacity * sizeof(P); }
+  };
+
+  /**
+   * Spreads threads over a small number of stripes so that per-thread book
+   *  keeping can be kept in separate cache lines without knowing how many
+   *  threads there are.
+   */
+  enum { numThreadStripes = 16 };
+  inline unsigned int threadStripe()
+  {
+    static thread_local unsigned int stripe =
+      (unsigned int)(std::hash<std::thread::id>()(std::this_thread::get_id()) % numThreadStripes);
+    return stripe;
+  }
+
+  /**
+   * A number for the calling thread, handed out in the order threads first ask for
+   *  one, so that threads spread evenly over however many shards there are.
+   */
+  inline unsigned int threadShard()
+  {
+    static std::atomic<unsigned int> next(0);
+    static thread_local unsigned int shard = next.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+  }
+
+  /**
+   * The memory for the replicas of a replicated Bean (see Bean<T>::replicated). 
+   *  Each replica starts on a cache line of it's own and doesn't share one with
+   *  any other.
+   */
+  class ReplicaStorage : public NoCopy
+  {
+    char* memory;
+
+  public:
+    enum { cacheLine = 64 };
+
+    char* first;
+    size_t stride;
+    unsigned int count;
+    unsigned int constructed; // how many (from the first) hold an instance
+
+    inline ReplicaStorage(unsigned int count_, size_t size) : 
+      stride(((size + cacheLine - 1) / cacheLine) * cacheLine), count(count_), constructed(0)
+    {
+      memory = new char[stride * count + cacheLine - 1];
+      first = memory + ((cacheLine - ((std::uintptr_t)memory % cacheLine)) % cacheLine);
+    }
+
+    inline ~ReplicaStorage() { delete [] memory; }
+
+    inline void* at(unsigned int i) const { return first + stride * i; }
+  };
+
+  /**
+   * A 32 bit hash of a type's name. The same type has the same tag in every 
+   *  module (different types can share one, so a match still has to be checked)
+   *  which lets the registry compare types in bulk (see discan.h).
+   */
+  typedef unsigned int TypeTag;
+
+  inline TypeTag tagOf(const std::type_info& type)
+  {
+    const char* name = type.name();
+    unsigned long long hash = hashBytes(name, std::strlen(name));
+    return (TypeTag)(hash ^ (hash >> 32));
+  }
+
+  // only hashed once per type
+  template<class T> inline TypeTag typeTag() { static const TypeTag tag = tagOf(typeid(T)); return tag; }
 
   class RequirementBase;
   class BeanBase;
+  class SwapCell;
   class FactoryBase;
+  class Registry;
+  class StartPlan;
 
   /**
    * holds simple rtti type information. Defines equivalence and toString
@@ -37,32 +168,34 @@ namespace internal
     friend class FactoryBase;
 
   protected:
-    const char* objId;
+    Symbol objId;
     const std::type_info* type;
+    TypeTag tag;
 
-    inline InstanceBase(const std::type_info& type_) : objId(NULL), type(&type_) 
+    inline InstanceBase(const std::type_info& type_, TypeTag tag_) : objId(NULL), type(&type_), tag(tag_)
     { 
 #ifdef DI__DEPENDENCY_INJECTION_DEBUG
       std::cout << "Creating type:" << type_.name() << std::endl; 
 #endif
     }
 
-    inline InstanceBase(const char* id, const std::type_info& type_) : objId(id), type(&type_) 
+    inline InstanceBase(Symbol id, const std::type_info& type_, TypeTag tag_) : objId(id), type(&type_), tag(tag_)
     { 
 #ifdef DI__DEPENDENCY_INJECTION_DEBUG
       std::cout << "Creating type:" << type_.name() << std::endl; 
 #endif
     }
 
-    inline InstanceBase(const InstanceBase& other) : objId(other.objId), type(other.type) {}
-    inline InstanceBase& operator=(const InstanceBase& other) { objId = other.objId; type=other.type; return *this; }
+    inline InstanceBase(const InstanceBase& other) : objId(other.objId), type(other.type), tag(other.tag) {}
+    inline InstanceBase& operator=(const InstanceBase& other) { objId = other.objId; type=other.type; tag=other.tag; return *this; }
 
   public:
 
     inline bool sameInstance(const InstanceBase& other) const { return (*type) == (*(other.type)); }
     inline const std::string toString() const { return type->name(); }
     inline const std::type_info& getInstanceInfo() const { return (*type); }
-    inline const char* getId() const { return objId; }
+    inline Symbol getId() const { return objId; }
+    inline TypeTag getTag() const { return tag; }
   };
 
   /**
@@ -73,9 +206,10 @@ namespace internal
   {
     friend class BeanBase;
   protected:
-    inline explicit InstanceConverterBase(const std::type_info& type) : InstanceBase(type) {}
-    virtual void* doConvert(void*) = 0;
-    inline bool isInstanceToConvertTo(const InstanceBase& to) { return (*this).sameInstance(to); }
+    inline InstanceConverterBase(const std::type_info& type, TypeTag tag) : InstanceBase(type, tag) {}
+    virtual void* doConvert(void*) const = 0;
+    inline bool isInstanceToConvertTo(const InstanceBase& to) const { return (*this).sameInstance(to); }
+    inline bool isInstanceToConvertTo(const std::type_info& to) const { return (*type) == to; }
   };
 
   /**
@@ -85,14 +219,33 @@ namespace internal
   {
   protected:
 
-    virtual inline void* doConvert(void * from) { return dynamic_cast<T*>((F*)from); }
-    inline T* convert(F* from) { return (T*)doConvert(from); }
+    virtual inline void* doConvert(void * from) const { return dynamic_cast<T*>((F*)from); }
+    inline T* convert(F* from) const { return (T*)doConvert(from); }
+
+    inline InstanceConverter() : InstanceConverterBase(typeid(T), typeTag<T>()) {}
 
   public:
-    // this needs to be public for the "<class D> Bean<T>::isAlso" method
-    inline InstanceConverter() : InstanceConverterBase(typeid(T)) {}
+    /**
+     * Converters have no state so there's only ever one of each. This needs
+     *  to be public for the "<class D> Bean<T>::isAlso" method.
+     */
+    static inline const InstanceConverterBase* get() { static const InstanceConverter<T,F> converter; return &converter; }
   };
 
+  /**
+   * Something a Bean depends on (see FactoryBase::dependencies and 
+   *  RequirementBase::dependencies): which instance, and how it's injected.
+   */
+  struct Dependency : public InstanceBase
+  {
+    enum Kind { constructor = 0, setter, all, provider, replicas, swappable };
+    Kind kind;
+
+    inline Dependency(const InstanceBase& required, Kind kind_) : InstanceBase(required), kind(kind_) {}
+  };
+
+  typedef std::vector<Dependency> Dependencies;
+
   class FactoryBase
   {
   private:
@@ -103,7 +256,69 @@ namespace internal
 
     virtual void* create(Context* context) /*throw (DependencyInjectionException) */ = 0;
 
+    /**
+     * Gets rid of an instance returned from 'create'.
+     */
+    virtual void destroy(void* instance) = 0;
+
+    /**
+     * The same as 'create' and 'destroy' but for an instance in memory the caller 
+     *  owns (see ReplicaStorage). Factories that can't do this return NULL.
+     */
+    virtual void* createAt(Context* /*context*/, void* /*memory*/) /*throw (DependencyInjectionException) */ { return NULL; }
+    virtual void destroyAt(void* /*instance*/) {}
+
+    /**
+     * Whether the instance came from outside of the context rather than being 
+     *  created by it.
+     */
+    virtual bool isAdopted() const { return false; }
+
+    /**
+     * The size of the factory including any constants it holds (shallowly).
+     */
+    virtual size_t footprint() const = 0;
+
     virtual bool dependenciesSatisfied(Context* context) = 0;
+
+    /**
+     * Adds the instances the constructor is passed.
+     */
+    virtual void dependencies(Dependencies& /*ret*/) const {}
+  };
+
+  /**
+   * Something that's injected in place of a Bean's instance where it's required
+   *  as the interface this is an instance of (see Bean<T>::decorate). Decorators of
+   *  the same interface are kept in the order they're declared and each one wraps 
+   *  the one before it.
+   */
+  class DecoratorBase : public InstanceBase
+  {
+  public:
+    void* instance; // a pointer to the decorator, as the interface, while the Bean is instantiated
+    DecoratorBase* next;
+
+    inline DecoratorBase(const std::type_info& type, TypeTag tag) : InstanceBase(type, tag), instance(NULL), next(NULL) {}
+    virtual inline ~DecoratorBase() {}
+
+    /**
+     * 'inner' points to what's decorated, as the interface, and so does what's 
+     *  returned.
+     */
+    virtual void* create(void* inner) /*throw (DependencyInjectionException) */ = 0;
+    virtual void destroy(void* decorator) = 0;
+    virtual size_t footprint() const = 0;
+  };
+
+  template<class I, class D> class Decorator : public DecoratorBase
+  {
+  public:
+    inline Decorator() : DecoratorBase(typeid(I), typeTag<I>()) {}
+
+    inline virtual void* create(void* inner) /*throw (DependencyInjectionException) */ { return static_cast<I*>(new D((I*)inner)); }
+    inline virtual void destroy(void* decorator) { delete static_cast<D*>((I*)decorator); }
+    inline virtual size_t footprint() const { return sizeof(*this); }
   };
 
   /**
@@ -112,61 +327,244 @@ namespace internal
   class BeanBase : public NoCopy
   {
     friend class di::Context;
+    friend class di::Module;
+    friend class Registry;
+    friend class StartPlan;
     friend class RequirementBase;
     friend class FactoryBase;
 
   protected:
+    typedef SmallVector<const InstanceConverterBase*,2> Converters;
+    typedef SmallVector<RequirementBase*,2> Requirements;
 
-    InstanceBase type;
-    std::string id;
-    bool hasId;
+    // the pointers come first and the flags are packed in after them, see the
+    //  size check following the class.
+    const std::type_info* type;
+    Symbol id; // NULL if there is no id
 
-    std::vector<InstanceConverterBase*> isAlsoTheseInstances;
-    std::vector<RequirementBase*> requirements;
+    Converters isAlsoTheseInstances;
+    Requirements requirements;
     internal::FactoryBase* factory;
-    bool hasBean;
+    ReplicaStorage* replicas; // while a replicated Bean is instantiated
+    DecoratorBase* decorators; // in the order they were declared
+    SwapCell* swapCell; // where a swappable Bean publishes it's instance
+#if !DI_EXCEPTIONS
+    // without exceptions a mistake in the declaration is kept until start reports it
+    Status* declarationError;
+#endif
+
+    TypeTag tag;
+    unsigned int replicaCount; // 0 unless replicated
+
+    // what start has done with it. The starter changes these while other threads
+    //  (in waitFor, find or markReady) read them, so they're atomic rather than
+    //  packed in with the flags below.
+    std::atomic<bool> hasBean;
+    std::atomic<bool> ready; // postConstructed, set under the Context's readyLock
+    std::atomic<bool> dormant; // not needed by any root so the last start left it alone
+    std::atomic<bool> deferred; // the last start left it for onForked
+
+    // how it was declared, which doesn't change once it's declared
+    bool prototypeScope : 1; // a new instance per acquire rather than a singleton
+    bool lazyScope : 1; // a singleton that's created the first time it's needed
+    bool rootScope : 1; // needed by the program rather than (only) by other instances
+    bool sideEffectsScope : 1; // has to be cleaned up even when the process is exiting
+    bool afterForkScope : 1; // per process so it's created in each child (see Context::onForked)
 
     virtual void doPostConstruct() = 0;
     virtual void doPreDestroy() = 0;
+    virtual void doWarmUp() = 0;
+    virtual bool hasWarmUp() const = 0;
+    virtual void doPostConstructAt(unsigned int i) = 0;
+
+    /**
+     * For a Bean declared 'checkpointed' (see Bean<T>::checkpointed). Instance 'i' 
+     *  saves it's state to 'state', or restores it from 'data' in place of being
+     *  postConstructed. Restoring returns false if the instance didn't take it.
+     */
+    virtual bool isCheckpointed() const = 0;
+    virtual void saveState(unsigned int i, std::string& state) = 0;
+    virtual bool restoreState(unsigned int i, const char* data, size_t size) = 0;
+
+    inline BeanBase(FactoryBase* f, Symbol name, const InstanceBase& tb) : 
+      type(&tb.getInstanceInfo()), id(name), factory(f), replicas(NULL), decorators(NULL), swapCell(NULL),
+#if !DI_EXCEPTIONS
+      declarationError(NULL),
+#endif
+      tag(tb.getTag()), replicaCount(0), hasBean(false), ready(false), dormant(false), deferred(false), prototypeScope(false), 
+      lazyScope(false), rootScope(false), sideEffectsScope(false), afterForkScope(false)
+    {}
 
-    inline BeanBase(FactoryBase* f, const char* name, const InstanceBase& tb) : 
-      type(tb), hasId(false), factory(f), hasBean(false) { if (name) { id = name; hasId = true; } }
-
-    inline virtual ~BeanBase() { if (factory) delete factory; }
+    inline virtual ~BeanBase();
 
-    inline std::vector<RequirementBase*>& getRequirements() { return requirements; }
+    inline Requirements& getRequirements() { return requirements; }
 
     inline void setFactory(FactoryBase* newFactory) { if (factory) delete factory; factory = newFactory; }
 
+#if !DI_EXCEPTIONS
+    // keeps the first failure recorded on this thread (see internal::failure)
+    inline void declarationFailed() { if (declarationError == NULL) declarationError = new Status(takeFailure()); else clearFailure(); }
+#endif
+
     bool canConvertTo(const InstanceBase& other) const;
 
     virtual void instantiateBean(di::Context*) = 0;
 
+    /**
+     * Creates (and deletes) the decorators for an instantiated Bean.
+     */
+    void createDecorators() /* throw (DependencyInjectionException) */;
+    void destroyDecorators();
+
+    void addDecorator(DecoratorBase* decorator);
+
+    // the outermost decorator of 'as', or NULL if it isn't decorated
+    void* decorated(const InstanceBase& as) const;
+
+    // what 'convertTo' returns without the decorators
+    void* convertUndecorated(const InstanceBase& typeToConvertTo) const /* throw (DependencyInjectionException) */;
+
     virtual void reset() = 0;
+
+    /**
+     * Drops what's only needed to create and wire the instance (see Context::compact).
+     */
+    virtual void compact() = 0;
   public:
     virtual const void* getConcrete() const = 0;
 
     void* convertTo(const InstanceBase& typeToConvertTo) const /* throw (DependencyInjectionException) */;
 
+    inline bool isDecorated() const { return decorators != NULL; }
+
     inline bool instantiated() { return hasBean; }
 
-    inline const std::string toString() const { return hasId ? (id + ":" + type.toString()) : type.toString(); }
+    inline bool isPrototype() const { return prototypeScope; }
+
+    inline bool isLazy() const { return lazyScope; }
+
+    inline bool isRoot() const { return rootScope; }
+
+    inline bool isDormant() const { return dormant; }
+
+    inline bool isReplicated() const { return replicaCount != 0; }
+
+    /**
+     * The number of instances this has when it's instantiated, and each of them.
+     *  Only replicated Beans have more than one.
+     */
+    inline unsigned int numInstances() const { return replicaCount ? replicaCount : 1; }
+    inline void* instanceAt(unsigned int i) const { return replicas ? replicas->at(i) : (void*)getConcrete(); }
+    inline const ReplicaStorage* getReplicas() const { return replicas; }
+
+    inline bool isSwappable() const { return swapCell != NULL; }
+
+    inline bool hasSideEffects() const { return sideEffectsScope; }
+
+    inline bool isAfterFork() const { return afterForkScope; }
+
+    inline bool isDeferred() const { return deferred; }
+
+    /**
+     * Does the current (or last) start create this. Lazy instances are created 
+     *  when they're needed, dormant ones not at all and deferred ones by onForked.
+     */
+    inline bool createdByStart() const { return !lazyScope && !dormant && !deferred; }
+    inline SwapCell* getSwapCell() const { return swapCell; }
+
+    /**
+     * Adds everything this depends on: constructor parameters and requirements.
+     */
+    inline void dependencies(Dependencies& ret) const;
+
+    inline const std::type_info& getType() const { return *type; }
+
+    inline bool hasId() const { return id != NULL; }
+
+    /**
+     * The bytes used by this declaration: the Bean itself and everything it
+     *  owns, but not the instance.
+     */
+    virtual size_t footprint() const;
+
+    /**
+     * The (shallow) size of the instance this declares.
+     */
+    virtual size_t instanceSize() const = 0;
+
+    inline const std::string toString() const { return hasId() ? (*id + ":" + type->name()) : std::string(type->name()); }
+
+    /**
+     * Ids are interned so comparing them is comparing pointers. A NULL 'id_'
+     *  matches any (or no) id.
+     */
+    inline bool matches(const InstanceBase& typeInfo, Symbol id_, bool exact) const
+    {
+      return ((exact && tag == typeInfo.getTag() && (*type) == typeInfo.getInstanceInfo()) ||
+              (!exact && canConvertTo(typeInfo))) &&
+        (id_ == NULL || id == id_);
+    }
   };
 
+  // a context holds a lot of these so anything added to BeanBase should fit in
+  //  with the flags after it's pointers rather than adding a word of padding.
+  static_assert(sizeof(BeanBase) <= 7 * sizeof(void*) + 2 * sizeof(SmallVector<void*,2>) + (DI_EXCEPTIONS ? 0 : sizeof(void*)) + 16,
+                "BeanBase has grown, see the layout of it's fields.");
+
   /**
    * base class for the template that defines a requirement.
    */
   class RequirementBase
   {
     friend class di::Context;
+    friend class BeanBase;
+    template<class T> friend class di::Bean;
 
   protected:
     inline RequirementBase() {  }
     virtual ~RequirementBase() {}
 
-    virtual void satisfy(BeanBase* instance, Context* context) /* throw (DependencyInjectionException) */ = 0;
+    /**
+     * The size of the requirement including what it holds (shallowly).
+     */
+    virtual size_t footprint() const = 0;
+
+    /**
+     * Satisfies the requirement on 'concrete' which is an instance declared by 'instance'.
+     */
+    virtual void satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */ = 0;
+
+    /**
+     * Adds the instances this injects.
+     */
+    virtual void dependencies(Dependencies& ret) const = 0;
   };
 
+  inline BeanBase::~BeanBase()
+  {
+    if (factory) 
+      delete factory;
+    for (Requirements::iterator it = requirements.begin(); it != requirements.end(); it++)
+      delete (*it);
+#if !DI_EXCEPTIONS
+    delete declarationError;
+#endif
+    while (decorators != NULL)
+    {
+      DecoratorBase* next = decorators->next;
+      delete decorators;
+      decorators = next;
+    }
+  }
+
+  inline void BeanBase::dependencies(Dependencies& ret) const
+  {
+    if (factory)
+      factory->dependencies(ret);
+    for (Requirements::const_iterator it = requirements.begin(); it != requirements.end(); it++)
+      (*it)->dependencies(ret);
+  }
+
   template<class T, class D> struct Setter
   {
     typedef void (T::*type)(D);
@@ -177,5 +575,46 @@ namespace internal
     typedef void (T::*type)(const std::vector<D>);
   };
 
+  template<class T, class D> struct SetterAllRef
+  {
+    typedef void (T::*type)(const std::vector<D>&);
+  };
+
+  template<class T, class D> struct SetterAllMove
+  {
+    typedef void (T::*type)(std::vector<D>&&);
+  };
+
+  template<class T, class D> struct SetterProvider
+  {
+    typedef void (T::*type)(di::Provider<D>);
+  };
+
+  template<class T, class D> struct SetterProviderRef
+  {
+    typedef void (T::*type)(const di::Provider<D>&);
+  };
+
+  template<class T, class D> struct SetterReplicas
+  {
+    typedef void (T::*type)(di::Replicas<D>);
+  };
+
+  template<class T, class D> struct SetterReplicasRef
+  {
+    typedef void (T::*type)(const di::Replicas<D>&);
+  };
+
+  template<class T, class D> struct SetterSwappable
+  {
+    typedef void (T::*type)(di::Swappable<D>);
+  };
+
+  template<class T, class D> struct SetterSwappableRef
+  {
+    typedef void (T::*type)(const di::Swappable<D>&);
+  };
+
+
 }
 
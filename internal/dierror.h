@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"dierror.h\" directly."
+#endif
+
+/**
+ * Whether the library is being compiled with exceptions. When it isn't (for example
+ *  -fno-exceptions) every place that would have thrown records what went wrong (see
+ *  internal::failure) and returns instead, and the callers check for that on the
+ *  way back out (DI_PROPAGATE).
+ */
+#ifndef DI_EXCEPTIONS
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define DI_EXCEPTIONS 1
+#else
+#define DI_EXCEPTIONS 0
+#endif
+#endif
+
+#if DI_EXCEPTIONS
+#define DI_FAIL(retval, ...) throw ::di::internal::failure(__VA_ARGS__)
+#define DI_FAILED() false
+#define DI_PROPAGATE(retval) do {} while (false)
+#define DI_CLEAR_FAILURE() do {} while (false)
+#define DI_TRY try
+#define DI_CATCH(decl) catch (decl)
+#define DI_CATCH_ALL catch (...)
+#define DI_RETHROW throw
+#define DI_FAIL_DECLARATION(...) throw ::di::internal::failure(::di::Status::badDeclaration, this->toString(), std::string(), __VA_ARGS__)
+#else
+#define DI_FAIL(retval, ...) do { ::di::internal::failure(__VA_ARGS__); return retval; } while (false)
+#define DI_FAILED() ::di::internal::failed()
+#define DI_PROPAGATE(retval) do { if (::di::internal::failed()) return retval; } while (false)
+#define DI_CLEAR_FAILURE() ::di::internal::clearFailure()
+// there's nothing to catch so the handlers are never run. They can't name what
+//  they catch since it doesn't exist.
+#define DI_TRY if (true)
+#define DI_CATCH(decl) else if (false)
+#define DI_CATCH_ALL else if (false)
+#define DI_RETHROW do {} while (false)
+// a Bean's declaration methods return the Bean so the failure is kept with it 
+//  and reported by the next start.
+#define DI_FAIL_DECLARATION(...) do { ::di::internal::failure(::di::Status::badDeclaration, this->toString(), std::string(), __VA_ARGS__); this->declarationFailed(); return *this; } while (false)
+#endif
+
+namespace internal
+{
+  /**
+   * The details of the last failure on this thread. This is how the 'try' methods
+   *  (see Context::tryStart) find out what went wrong and, without exceptions, how
+   *  the library finds out that something did.
+   */
+  inline Status& pendingFailure() { static thread_local Status failure; return failure; }
+
+  inline bool failed() { return pendingFailure().kind != Status::ok; }
+
+  inline void clearFailure()
+  {
+    Status& failure = pendingFailure();
+    if (failure.kind != Status::ok)
+      failure = Status();
+  }
+
+  inline Status takeFailure()
+  {
+    Status ret;
+    std::swap(ret, pendingFailure());
+    return ret;
+  }
+
+  /**
+   * Records a failure for this thread and returns the exception that describes it
+   *  (which is thrown when there are exceptions). Constructing the exception logs
+   *  the message.
+   */
+  inline DependencyInjectionException failure(Status::Kind kind, const std::string& bean, const std::string& requirement, const char* fmt, ...)
+  {
+    char buf[1024];
+    va_list argList;
+    va_start(argList, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, argList);
+    va_end(argList);
+
+    pendingFailure() = Status(kind, bean, requirement, buf);
+    return DependencyInjectionException("%s", buf);
+  }
+
+  /**
+   * What a 'try' method returns for an exception it caught. That's the failure 
+   *  recorded for it unless it was thrown by something other than the library.
+   */
+  inline Status caught(const char* message)
+  {
+    Status ret = takeFailure();
+    if (ret.isOk())
+      ret = Status(Status::callbackFailed, std::string(), std::string(), message);
+    return ret;
+  }
+}
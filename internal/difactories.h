@@ -26,9 +26,15 @@ namespace internal
   public:
     inline Factory0() { }
 
-    inline virtual bool dependenciesSatisfied(Context* context) { return true; }
+    inline virtual bool dependenciesSatisfied(Context* /*context*/) { return true; }
 
-    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */ { return new M; }
+    inline virtual size_t footprint() const { return sizeof(*this); }
+
+    inline virtual void destroy(void* instance) { delete (M*)instance; }
+    inline virtual void destroyAt(void* instance) { ((M*)instance)->~M(); }
+
+    inline virtual void* create(Context* /*context*/) /* throw (DependencyInjectionException) */ { return new M; }
+    inline virtual void* createAt(Context* /*context*/, void* memory) /* throw (DependencyInjectionException) */ { return new (memory) M; }
   };
 
   /**
@@ -45,9 +51,23 @@ namespace internal
 
     inline virtual bool dependenciesSatisfied(Context* context) { return p1.available(context); }
 
-    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */
+    inline virtual void dependencies(Dependencies& ret) const { p1.addDependency(ret); }
+
+    inline virtual size_t footprint() const { return sizeof(*this); }
+
+    inline virtual void destroy(void* instance) { delete (M*)instance; }
+    inline virtual void destroyAt(void* instance) { ((M*)instance)->~M(); }
+
+    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */ { return createAt(context, NULL); }
+
+    // NULL 'memory' allocates the instance
+    inline virtual void* createAt(Context* context, void* memory) /* throw (DependencyInjectionException) */
     {
-      return new M(p1.findIsAlso(context));
+      // each parameter is found before the constructor is called so that, without 
+      //  exceptions, a failure doesn't construct one with NULLs.
+      auto&& a1 = p1.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      return memory ? new (memory) M(a1) : new M(a1);
     }
   };
 
@@ -69,9 +89,23 @@ namespace internal
       return p1.available(context) && p2.available(context);
     }
 
-    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */
+    inline virtual void dependencies(Dependencies& ret) const { p1.addDependency(ret); p2.addDependency(ret); }
+
+    inline virtual size_t footprint() const { return sizeof(*this); }
+
+    inline virtual void destroy(void* instance) { delete (M*)instance; }
+    inline virtual void destroyAt(void* instance) { ((M*)instance)->~M(); }
+
+    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */ { return createAt(context, NULL); }
+
+    // NULL 'memory' allocates the instance
+    inline virtual void* createAt(Context* context, void* memory) /* throw (DependencyInjectionException) */
     {
-      return new M(p1.findIsAlso(context),p2.findIsAlso(context));
+      auto&& a1 = p1.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      auto&& a2 = p2.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      return memory ? new (memory) M(a1,a2) : new M(a1,a2);
     }
   };
 
@@ -94,9 +128,25 @@ namespace internal
       return p1.available(context) && p2.available(context) && p3.available(context); 
     }
 
-    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */
+    inline virtual void dependencies(Dependencies& ret) const { p1.addDependency(ret); p2.addDependency(ret); p3.addDependency(ret); }
+
+    inline virtual size_t footprint() const { return sizeof(*this); }
+
+    inline virtual void destroy(void* instance) { delete (M*)instance; }
+    inline virtual void destroyAt(void* instance) { ((M*)instance)->~M(); }
+
+    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */ { return createAt(context, NULL); }
+
+    // NULL 'memory' allocates the instance
+    inline virtual void* createAt(Context* context, void* memory) /* throw (DependencyInjectionException) */
     {
-      return new M(p1.findIsAlso(context),p2.findIsAlso(context),p3.findIsAlso(context));
+      auto&& a1 = p1.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      auto&& a2 = p2.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      auto&& a3 = p3.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      return memory ? new (memory) M(a1,a2,a3) : new M(a1,a2,a3);
     }
   };
 
@@ -119,13 +169,78 @@ namespace internal
       return p1.available(context) && p2.available(context) && p3.available(context) && p4.available(context); 
     }
 
-    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */
+    inline virtual void dependencies(Dependencies& ret) const { p1.addDependency(ret); p2.addDependency(ret); p3.addDependency(ret); p4.addDependency(ret); }
+
+    inline virtual size_t footprint() const { return sizeof(*this); }
+
+    inline virtual void destroy(void* instance) { delete (M*)instance; }
+    inline virtual void destroyAt(void* instance) { ((M*)instance)->~M(); }
+
+    inline virtual void* create(Context* context) /* throw (DependencyInjectionException) */ { return createAt(context, NULL); }
+
+    // NULL 'memory' allocates the instance
+    inline virtual void* createAt(Context* context, void* memory) /* throw (DependencyInjectionException) */
     {
-      return new M(p1.findIsAlso(context),p2.findIsAlso(context),p3.findIsAlso(context),p4.findIsAlso(context));
+      auto&& a1 = p1.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      auto&& a2 = p2.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      auto&& a3 = p3.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      auto&& a4 = p4.findIsAlso(context);
+      DI_PROPAGATE(NULL);
+      return memory ? new (memory) M(a1,a2,a3,a4) : new M(a1,a2,a3,a4);
     }
   };
   //=======================================================================
 
+  /**
+   * "Factory" for an instance that was created outside of the context (see 
+   *  Declarations::has(const Instance<T>&, T*) and friends). The context never
+   *  deletes it. Whatever ownership the context was given is let go of when the
+   *  factory is deleted along with it's Bean, so the instance survives a stop()
+   *  and the context can be started again.
+   */
+  template<typename M> class Adopted : public internal::FactoryBase
+  {
+    std::shared_ptr<M> instance;
+
+  public:
+    inline explicit Adopted(const std::shared_ptr<M>& instance_) : instance(instance_) {}
+
+    inline virtual bool dependenciesSatisfied(Context* /*context*/) { return true; }
+
+    inline virtual size_t footprint() const { return sizeof(*this); }
+
+    inline virtual void* create(Context* /*context*/) { return instance.get(); }
+
+    inline virtual void destroy(void*) {}
+
+    inline virtual bool isAdopted() const { return true; }
+  };
+
+  /**
+   * What's left of a Bean's factory once the Bean is compacted (see 
+   *  Context::compact): enough to delete the instance, but not to create another.
+   */
+  template<typename M> class Compacted : public internal::FactoryBase
+  {
+  public:
+    inline virtual bool dependenciesSatisfied(Context* /*context*/) { return false; }
+
+    inline virtual size_t footprint() const { return sizeof(*this); }
+
+    inline virtual void* create(Context* /*context*/) { return NULL; }
+
+    inline virtual void destroy(void* instance) { delete (M*)instance; }
+    inline virtual void destroyAt(void* instance) { ((M*)instance)->~M(); }
+  };
+
+  /**
+   * The deleter for instances that are adopted without ownership.
+   */
+  template<typename M> struct NoDelete { inline void operator()(M*) const {} };
+
   template<typename T> class StaticSetterCaller
   {
   public:
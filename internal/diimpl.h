@@ -12,7 +12,7 @@
 
 namespace internal
 {
-  template<class T, class D, class RDT> inline void Requirement<T,D,RDT>::satisfy(BeanBase* instance, Context* context) /* throw (DependencyInjectionException) */
+  template<class T, class D, class RDT> inline void Requirement<T,D,RDT>::satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */
   {
 #ifdef DI__DEPENDENCY_INJECTION_DEBUG
     std::cout << "requirement:" << toString() << " is satisfied by " << dep->toString() << std::endl;
@@ -20,51 +20,309 @@ namespace internal
     std::vector<BeanBase*> satisfiedBy;
     parameter.findAll(satisfiedBy,context,false);
     if (satisfiedBy.size() == 0)
-      throw DependencyInjectionException("Cannot satisfy the requirement of \"%s\" which requires \"%s\".", instance->toString().c_str(), parameter.toString().c_str());
+      DI_FAIL(, Status::unsatisfied, instance->toString(), parameter.toString(), "Cannot satisfy the requirement of \"%s\" which requires \"%s\".", instance->toString().c_str(), parameter.toString().c_str());
     if (satisfiedBy.size() > 1)
-      throw DependencyInjectionException("Ambiguous requirement of \"%s\" for \"%s\".", instance->toString().c_str(), parameter.toString().c_str());
+      DI_FAIL(, Status::ambiguous, instance->toString(), parameter.toString(), "Ambiguous requirement of \"%s\" for \"%s\".", instance->toString().c_str(), parameter.toString().c_str());
     BeanBase* dep = satisfiedBy.front();
-    (((T*)instance->getConcrete())->*(setter)) ((RDT)dep->getConcrete());
+    if (dep->isPrototype())
+      DI_FAIL(, Status::notInjectable, instance->toString(), parameter.toString(), "\"%s\" requires \"%s\" which is a prototype and must be acquired from the context rather than injected.", instance->toString().c_str(), dep->toString().c_str());
+    if (dep->isLazy())
+      DI_FAIL(, Status::notInjectable, instance->toString(), parameter.toString(), "\"%s\" requires \"%s\" which is lazy and must be injected using a Provider.", instance->toString().c_str(), dep->toString().c_str());
+    if (dep->isReplicated())
+      DI_FAIL(, Status::notInjectable, instance->toString(), parameter.toString(), "\"%s\" requires \"%s\" which is replicated and must be injected using Replicas.", instance->toString().c_str(), dep->toString().c_str());
+    if (dep->isSwappable())
+      DI_FAIL(, Status::notInjectable, instance->toString(), parameter.toString(), "\"%s\" requires \"%s\" which is swappable and must be injected using a Swappable.", instance->toString().c_str(), dep->toString().c_str());
+    // converted since what's required needn't be where the instance starts (a second base)
+    context->counters.count(Counters::conversions);
+    void* converted = dep->convertTo(parameter);
+    DI_PROPAGATE();
+    (((T*)concrete)->*(setter)) ((RDT)converted);
   }
 
-  template<class T, class D, class RDT> inline void RequirementConstant<T,D,RDT>::satisfy(BeanBase* instance, Context* context) /* throw (DependencyInjectionException) */
+  template<class T, class D, class RDT> inline void RequirementConstant<T,D,RDT>::satisfy(BeanBase* /*instance*/, void* concrete, Context* context) /* throw (DependencyInjectionException) */
   {
 #ifdef DI__DEPENDENCY_INJECTION_DEBUG
     std::cout << "requirement:" << toString() << " is satisfied by " << dep->toString() << std::endl;
 #endif
-    (((T*)instance->getConcrete())->*(setter)) (parameter.findIsAlso(context));
+    (((T*)concrete)->*(setter)) (parameter.findIsAlso(context));
   }
 
-  template<class T, class D, class RDT> inline void RequirementAll<T,D,RDT>::satisfy(BeanBase* instance, Context* context) /* throw (DependencyInjectionException) */
+  /**
+   * Collects the instances for a RequirementAll straight from the matching Beans,
+   *  each converted to what's required.
+   */
+  template<class RDT> struct CollectAll
+  {
+    std::vector<RDT>& instances;
+    BeanBase* requiredBy;
+    const InstanceBase& required;
+    Context* context;
+
+    inline CollectAll(std::vector<RDT>& i, BeanBase* r, const InstanceBase& p, Context* c) : instances(i), requiredBy(r), required(p), context(c) {}
+
+    inline void reserve(size_t count) { instances.reserve(count); }
+
+    inline bool operator()(BeanBase* bean)
+    {
+      if (bean->isPrototype())
+        DI_FAIL(false, Status::notInjectable, requiredBy->toString(), required.toString(), "\"%s\" requires all \"%s\" but \"%s\" is a prototype and must be acquired from the context rather than injected.", requiredBy->toString().c_str(), required.toString().c_str(), bean->toString().c_str());
+      if (bean->isLazy())
+        DI_FAIL(false, Status::notInjectable, requiredBy->toString(), required.toString(), "\"%s\" requires all \"%s\" but \"%s\" is lazy and must be injected using a Provider.", requiredBy->toString().c_str(), required.toString().c_str(), bean->toString().c_str());
+      if (bean->isReplicated())
+        DI_FAIL(false, Status::notInjectable, requiredBy->toString(), required.toString(), "\"%s\" requires all \"%s\" but \"%s\" is replicated and must be injected using Replicas.", requiredBy->toString().c_str(), required.toString().c_str(), bean->toString().c_str());
+      if (bean->isSwappable())
+        DI_FAIL(false, Status::notInjectable, requiredBy->toString(), required.toString(), "\"%s\" requires all \"%s\" but \"%s\" is swappable and must be injected using a Swappable.", requiredBy->toString().c_str(), required.toString().c_str(), bean->toString().c_str());
+      context->counters.count(Counters::conversions);
+      void* converted = bean->convertTo(required);
+      DI_PROPAGATE(false);
+      instances.push_back((RDT)converted);
+      return true;
+    }
+  };
+
+  template<class T, class D, class RDT, class S> inline void RequirementAll<T,D,RDT,S>::satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */
   {
 #ifdef DI__DEPENDENCY_INJECTION_DEBUG
     std::cout << "requirement:" << toString() << " is satisfied by " << dep->toString() << std::endl;
 #endif
-    std::vector<BeanBase*> satisfiedBy;
-    parameter.findAll(satisfiedBy,context,false);
-    if (satisfiedBy.size() == 0)
-      throw DependencyInjectionException("Cannot satisfy the requirement of \"%s\" which requires \"%s\".", instance->toString().c_str(), parameter.toString().c_str());
     std::vector<RDT> instances;
-    for(std::vector<internal::BeanBase*>::iterator it = satisfiedBy.begin(); it != satisfiedBy.end(); it++)
-      instances.push_back((RDT)(*it)->getConcrete());
-    (((T*)instance->getConcrete())->*(setter)) (instances);
+    CollectAll<RDT> collect(instances,instance,parameter,context);
+    context->visitAll(collect,parameter,parameter.getId(),false);
+    DI_PROPAGATE();
+    if (instances.size() == 0)
+      DI_FAIL(, Status::unsatisfied, instance->toString(), parameter.toString(), "Cannot satisfy the requirement of \"%s\" which requires \"%s\".", instance->toString().c_str(), parameter.toString().c_str());
+
+    // whatever form the setter takes it can have the vector without a copy
+    (((T*)concrete)->*(setter)) (std::move(instances));
   }
+
+  template<class T, class D, class S> inline void RequirementProvider<T,D,S>::satisfy(BeanBase* /*instance*/, void* concrete, Context* context) /* throw (DependencyInjectionException) */
+  {
+    Provider<D> provider = Provider<D>::resolve(parameter,context);
+    DI_PROPAGATE();
+    (((T*)concrete)->*(setter)) (provider);
+  }
+
+  template<class T, class D, class S> inline void RequirementReplicas<T,D,S>::satisfy(BeanBase* /*instance*/, void* concrete, Context* context) /* throw (DependencyInjectionException) */
+  {
+    Replicas<D> replicas = Replicas<D>::resolve(parameter,context);
+    DI_PROPAGATE();
+    (((T*)concrete)->*(setter)) (replicas);
+  }
+
+  template<class T, class D, class S> inline void RequirementSwappable<T,D,S>::satisfy(BeanBase* /*instance*/, void* concrete, Context* context) /* throw (DependencyInjectionException) */
+  {
+    Swappable<D> swappable = Swappable<D>::resolve(parameter,context);
+    DI_PROPAGATE();
+    (((T*)concrete)->*(setter)) (swappable);
+  }
+
+}
+
+template<class V> inline void Context::visitAll(V& visitor, const internal::InstanceBase& typeInfo, internal::Symbol id, bool exact)
+{
+  // a thread sees what it's declared itself. 
+  if (staging.any())
+    publishStaged(false);
+  internal::Registry::View beans = registry.view();
+
+  // 'scanned' is how far along the candidates the visit got.
+  size_t scanned = 0;
+  if (beans.indexed())
+  {
+    // everything in the index provides the type so only the id (and for an exact
+    //  match, whether it's the Bean's own type) needs checking.
+    const internal::Registry::Provided* candidates = beans.provides(typeInfo.getInstanceInfo());
+    if (candidates == NULL)
+      return;
+
+    size_t count = candidates->beans.size();
+    visitor.reserve(count);
+    scanned = count;
+    for (size_t i = id ? internal::findSymbol(candidates->ids.data(), 0, count, id) : 0; i < count;
+         i = id ? internal::findSymbol(candidates->ids.data(), i + 1, count, id) : i + 1)
+      if ((!exact || candidates->exact[i]) && !visitor(candidates->beans[i]))
+      {
+        scanned = i + 1;
+        break;
+      }
+  }
+  else if (exact)
+  {
+    // the tags (or ids) are scanned and only the Beans that match are looked at.
+    size_t count = beans.size();
+    scanned = count;
+    internal::TypeTag tag = typeInfo.getTag();
+    const std::type_info& type = typeInfo.getInstanceInfo();
+    for (size_t i = id ? internal::findSymbol(beans.ids(), 0, count, id) : internal::findTag(beans.tags(), 0, count, tag); i < count;
+         i = id ? internal::findSymbol(beans.ids(), i + 1, count, id) : internal::findTag(beans.tags(), i + 1, count, tag))
+      if (beans.tags()[i] == tag && *(beans.types()[i]) == type && !visitor(beans[i]))
+      {
+        scanned = i + 1;
+        break;
+      }
+  }
+  else
+  {
+    // without the index what each Bean is also declared as has to be checked, 
+    //  though with an id only the Beans that have it are.
+    size_t count = beans.size();
+    scanned = count;
+    for (size_t i = id ? internal::findSymbol(beans.ids(), 0, count, id) : 0; i < count;
+         i = id ? internal::findSymbol(beans.ids(), i + 1, count, id) : i + 1)
+      if (beans[i]->matches(typeInfo,id,exact) && !visitor(beans[i]))
+      {
+        scanned = i + 1;
+        break;
+      }
+  }
+  counters.count(internal::Counters::candidatesScanned, scanned);
 }
 
 template<typename T> void Instance<T>::findAll(std::vector<internal::BeanBase*>& ret, Context* context, bool exact) const /* throw (DependencyInjectionException) */
 {
-  context->findAll(ret,*this,this->getId(),exact);
+  context->findAll(ret,*this,Id(this->getId()),exact);
 }
 
 template<typename T> inline T* Instance<T>::findIsAlso(Context* context) const /* throw (DependencyInjectionException) */
 {
-  internal::BeanBase* inst = context->find(*this,objId,false);
-  return inst ? (type)(inst->convertTo(*this)) : NULL;
+  internal::BeanBase* inst = context->find(*this,Id(objId),false);
+  if (inst == NULL)
+    return NULL;
+  if (inst->isReplicated())
+    DI_FAIL(NULL, Status::notInjectable, inst->toString(), toString(), "\"%s\" is replicated and must be injected using Replicas.", inst->toString().c_str());
+  if (inst->isSwappable())
+    DI_FAIL(NULL, Status::notInjectable, inst->toString(), toString(), "\"%s\" is swappable and must be injected using a Swappable.", inst->toString().c_str());
+  context->counters.count(internal::Counters::conversions);
+  return (type)(inst->convertTo(*this));
 }
 
 template<typename T> inline bool Instance<T>::available(Context* context) const 
 { 
-  internal::BeanBase* inst = context->find(*this,objId,false);
+  internal::BeanBase* inst = context->find(*this,Id(objId),false);
   return inst != NULL && inst->instantiated();
 }
 
+template<typename T> inline Provider<T> Provider<T>::resolve(const Instance<T>& required, Context* context) /* throw (DependencyInjectionException) */
+{
+  std::vector<internal::BeanBase*> satisfiedBy;
+  required.findAll(satisfiedBy,context,false);
+  if (satisfiedBy.size() == 0)
+    DI_FAIL(Provider<T>(), Status::unsatisfied, std::string(), required.toString(), "Cannot provide \"%s\" since there isn't one.", required.toString().c_str());
+  if (satisfiedBy.size() > 1)
+    DI_FAIL(Provider<T>(), Status::ambiguous, std::string(), required.toString(), "Ambiguous Provider for \"%s\".", required.toString().c_str());
+
+  internal::BeanBase* bean = satisfiedBy.front();
+  // a prototype hands out Leases on it's own type.
+  if (bean->isPrototype() && bean->getType() != typeid(T))
+    DI_FAIL(Provider<T>(), Status::notInjectable, bean->toString(), required.toString(), "Cannot provide \"%s\" from the prototype \"%s\" which is a different type.", required.toString().c_str(), bean->toString().c_str());
+  if (bean->isReplicated())
+    DI_FAIL(Provider<T>(), Status::notInjectable, bean->toString(), required.toString(), "Cannot provide \"%s\" since \"%s\" is replicated and must be injected using Replicas.", required.toString().c_str(), bean->toString().c_str());
+  if (bean->isSwappable())
+    DI_FAIL(Provider<T>(), Status::notInjectable, bean->toString(), required.toString(), "Cannot provide \"%s\" since \"%s\" is swappable and must be injected using a Swappable.", required.toString().c_str(), bean->toString().c_str());
+
+  Provider<T> ret(required);
+  ret.bean = bean;
+  ret.context = context;
+  if (!bean->isPrototype() && !bean->isLazy() && bean->instantiated())
+  {
+    context->counters.count(internal::Counters::conversions);
+    ret.instance = (T*)bean->convertTo(required);
+    DI_PROPAGATE(Provider<T>());
+  }
+  return ret;
+}
+
+template<typename T> inline Lease<T> Provider<T>::provide() const /* throw (DependencyInjectionException) */
+{
+  DI_CLEAR_FAILURE();
+  if (bean == NULL)
+    DI_FAIL(Lease<T>(), Status::wrongPhase, std::string(), required.toString(), "The %s was never resolved by a context.", toString().c_str());
+
+  if (bean->isPrototype())
+  {
+    Bean<T>* prototype = (Bean<T>*)bean;
+    if (!prototype->instantiated())
+      DI_FAIL(Lease<T>(), Status::wrongPhase, bean->toString(), std::string(), "Cannot acquire a \"%s\" until the context is started.", bean->toString().c_str());
+    T* acquired = prototype->acquireInstance(context);
+    DI_PROPAGATE(Lease<T>());
+    context->counters.count(internal::Counters::acquired);
+    return Lease<T>(prototype, acquired);
+  }
+
+  if (bean->isLazy())
+  {
+    context->instantiateLazy(bean);
+    DI_PROPAGATE(Lease<T>());
+  }
+  else if (!bean->instantiated())
+    DI_FAIL(Lease<T>(), Status::wrongPhase, bean->toString(), std::string(), "Cannot provide \"%s\" before it's been instantiated.", bean->toString().c_str());
+
+  context->counters.count(internal::Counters::conversions);
+  T* ret = (T*)bean->convertTo(required);
+  DI_PROPAGATE(Lease<T>());
+  instance.store(ret, std::memory_order_release);
+  return Lease<T>(NULL, ret);
+}
+
+template<typename T> inline bool Provider<T>::available(Context* context_) const
+{
+  // what's provided doesn't need to exist yet, just be declared.
+  return context_->find(required,Id(required.getId()),false) != NULL;
+}
+
+template<typename T> inline Provider<T> Provider<T>::findIsAlso(Context* context_) const /* throw (DependencyInjectionException) */
+{
+  return resolve(required,context_);
+}
+
+template<typename T> inline Replicas<T> Replicas<T>::resolve(const Instance<T>& required, Context* context) /* throw (DependencyInjectionException) */
+{
+  std::vector<internal::BeanBase*> satisfiedBy;
+  required.findAll(satisfiedBy,context,false);
+  if (satisfiedBy.size() == 0)
+    DI_FAIL(Replicas<T>(), Status::unsatisfied, std::string(), required.toString(), "Cannot inject the replicas of \"%s\" since there isn't one.", required.toString().c_str());
+  if (satisfiedBy.size() > 1)
+    DI_FAIL(Replicas<T>(), Status::ambiguous, std::string(), required.toString(), "Ambiguous Replicas for \"%s\".", required.toString().c_str());
+
+  internal::BeanBase* bean = satisfiedBy.front();
+  if (!bean->isReplicated() || bean->getType() != typeid(T))
+    DI_FAIL(Replicas<T>(), Status::notInjectable, bean->toString(), required.toString(), "Cannot inject the replicas of \"%s\" since \"%s\" isn't a replicated \"%s\".", required.toString().c_str(), bean->toString().c_str(), typeid(T).name());
+  const internal::ReplicaStorage* storage = bean->getReplicas();
+  if (storage == NULL)
+    DI_FAIL(Replicas<T>(), Status::wrongPhase, bean->toString(), required.toString(), "Cannot inject the replicas of \"%s\" before they've been instantiated.", bean->toString().c_str());
+
+  Replicas<T> ret(required);
+  ret.first = storage->first;
+  ret.stride = storage->stride;
+  ret.count = storage->count;
+  return ret;
+}
+
+template<typename T> inline Swappable<T> Swappable<T>::resolve(const Instance<T>& required, Context* context) /* throw (DependencyInjectionException) */
+{
+  std::vector<internal::BeanBase*> satisfiedBy;
+  required.findAll(satisfiedBy,context,false);
+  if (satisfiedBy.size() == 0)
+    DI_FAIL(Swappable<T>(), Status::unsatisfied, std::string(), required.toString(), "Cannot inject a swappable \"%s\" since there isn't one.", required.toString().c_str());
+  if (satisfiedBy.size() > 1)
+    DI_FAIL(Swappable<T>(), Status::ambiguous, std::string(), required.toString(), "Ambiguous Swappable for \"%s\".", required.toString().c_str());
+
+  internal::BeanBase* bean = satisfiedBy.front();
+  if (!bean->isSwappable() || bean->getType() != typeid(T))
+    DI_FAIL(Swappable<T>(), Status::notInjectable, bean->toString(), required.toString(), "Cannot inject a swappable \"%s\" since \"%s\" isn't a swappable \"%s\".", required.toString().c_str(), bean->toString().c_str(), typeid(T).name());
+
+  Swappable<T> ret(required);
+  ret.cell = bean->getSwapCell();
+  return ret;
+}
+
+template<typename T> inline void Bean<T>::compact()
+{
+  for (Requirements::iterator it = requirements.begin(); it != requirements.end(); it++)
+    delete (*it);
+  requirements.clear();
+  // an adopted instance's factory is what holds on to it.
+  if (!factory->isAdopted())
+    setFactory(new internal::Compacted<T>);
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"diplan.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * What a Context learned the last time it started: the order the Beans could be
+   *  instantiated in and how long each lifecycle stage took for each one. It's only
+   *  meaningful for the exact same set of declarations, which is identified by a
+   *  hash (see 'hashDefinition').
+   */
+  class StartPlan
+  {
+  public:
+    struct Step
+    {
+      size_t bean; // the Bean's position in the registry
+      std::chrono::nanoseconds instantiate;
+      std::chrono::nanoseconds postConstruct;
+      std::chrono::nanoseconds warmUp;
+
+      inline Step() : bean(0), instantiate(0), postConstruct(0), warmUp(0) {}
+    };
+
+    unsigned long long definition;
+    std::vector<Step> steps; // in the order the beans were instantiated
+
+    inline StartPlan() : definition(0) {}
+
+    /**
+     * Hashes what's been declared: each Bean's type, id and scope along with the
+     *  concrete types of its factory and requirements (which name the types they
+     *  inject). Anything that could change the instantiation order changes this.
+     */
+    static inline unsigned long long hashDefinition(const Registry::View& beans)
+    {
+      unsigned long long hash = hashBytes("", 0);
+      for (Registry::iterator it = beans.begin(); it != beans.end(); it++)
+        hash = hashBean(*it, hash);
+      return hash;
+    }
+
+    /**
+     * The part of 'hashDefinition' for one Bean. On it's own it identifies the 
+     *  Bean's declaration (see Snapshot::key).
+     */
+    static inline unsigned long long hashBean(const BeanBase* bean, unsigned long long hash = hashBytes("", 0))
+    {
+      hash = hashString(bean->type->name(), hash);
+      hash = hashString(bean->hasId() ? bean->id->c_str() : "", hash);
+      hash = hashString(bean->isPrototype() ? "p" : "s", hash);
+      if (bean->isRoot())
+        hash = hashString("r", hash);
+      hash = hashString(typeid(*(bean->factory)).name(), hash);
+      for (BeanBase::Requirements::const_iterator rit = bean->requirements.begin(); rit != bean->requirements.end(); rit++)
+        hash = hashString(typeid(*(*rit)).name(), hash);
+      return hashString(";", hash);
+    }
+
+    /**
+     * Reads a plan saved by 'save'. Returns false, leaving this plan empty, if
+     *  there is no such file, it can't be read, or it's for a different definition
+     *  (or number of Beans).
+     */
+    inline bool load(const std::string& path, unsigned long long expectedDefinition, size_t count)
+    {
+      steps.clear();
+      std::ifstream in(path.c_str());
+      std::string magic;
+      size_t numSteps = 0;
+      if (!(in >> magic >> std::hex >> definition >> std::dec >> numSteps) ||
+          magic != "diplan1" || definition != expectedDefinition || numSteps != count)
+        return fail();
+
+      std::vector<bool> seen(count, false);
+      for (size_t i = 0; i < numSteps; i++)
+      {
+        Step step;
+        long long instantiate, postConstruct, warmUp;
+        if (!(in >> step.bean >> instantiate >> postConstruct >> warmUp) || step.bean >= count || seen[step.bean])
+          return fail();
+        seen[step.bean] = true;
+        step.instantiate = std::chrono::nanoseconds(instantiate);
+        step.postConstruct = std::chrono::nanoseconds(postConstruct);
+        step.warmUp = std::chrono::nanoseconds(warmUp);
+        steps.push_back(step);
+      }
+      return true;
+    }
+
+    /**
+     * Writes the plan to 'path'. Returns false if it couldn't.
+     */
+    inline bool save(const std::string& path) const
+    {
+      std::ofstream out(path.c_str(), std::ios::trunc);
+      out << "diplan1 " << std::hex << definition << std::dec << " " << steps.size() << "\n";
+      for (std::vector<Step>::const_iterator it = steps.begin(); it != steps.end(); it++)
+        out << it->bean << " " << (long long)it->instantiate.count() << " " <<
+          (long long)it->postConstruct.count() << " " << (long long)it->warmUp.count() << "\n";
+      out.close();
+      return !out.fail();
+    }
+
+  private:
+    static inline unsigned long long hashString(const char* str, unsigned long long hash)
+    {
+      // include the terminator so that "ab","c" and "a","bc" differ
+      return hashBytes(str, std::strlen(str) + 1, hash);
+    }
+
+    inline bool fail() { steps.clear(); definition = 0; return false; }
+  };
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"dipool.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * A bounded pool of released prototype instances. The pool is split into 
+   *  shards and each thread uses the shard for it's stripe (see threadStripe) so
+   *  threads releasing and acquiring instances don't usually contend. When a 
+   *  thread's own shard is empty it will take an instance from any other shard it
+   *  can get without waiting. The shards only spread the contention. How many
+   *  instances the pool holds is counted across all of them so it never keeps
+   *  more than maxPooled, and a single thread can fill it.
+   *
+   * The pool only deals in pointers. Creating and destroying the instances is up
+   *  to the owning Bean.
+   */
+  class Pool : public NoCopy
+  {
+    enum { numShards = numThreadStripes };
+
+    struct Shard
+    {
+      std::mutex lock;
+      std::vector<void*> free;
+      bool opened;
+      char pad[64];
+
+      inline Shard() : opened(false) {}
+    };
+
+    Shard shards[numShards];
+    std::atomic<size_t> pooled; // in all of the shards
+    size_t maxPooled;
+
+  public:
+    inline explicit Pool(size_t maxPooled_) : pooled(0), maxPooled(maxPooled_) {}
+
+    /**
+     * Returns a pooled instance or NULL if there isn't one.
+     */
+    inline void* take()
+    {
+      if (pooled.load() == 0)
+        return NULL;
+
+      unsigned int mine = threadStripe();
+      {
+        std::lock_guard<std::mutex> lock(shards[mine].lock);
+        if (shards[mine].free.size() > 0)
+        {
+          void* ret = shards[mine].free.back();
+          shards[mine].free.pop_back();
+          pooled.fetch_sub(1);
+          return ret;
+        }
+      }
+
+      for (unsigned int i = 1; i < numShards; i++)
+      {
+        Shard& other = shards[(mine + i) % numShards];
+        std::unique_lock<std::mutex> lock(other.lock, std::try_to_lock);
+        if (lock.owns_lock() && other.free.size() > 0)
+        {
+          void* ret = other.free.back();
+          other.free.pop_back();
+          pooled.fetch_sub(1);
+          return ret;
+        }
+      }
+
+      return NULL;
+    }
+
+    /**
+     * Returns the instance to the pool. false means the pool is either full or
+     *  closed and the caller needs to destroy the instance instead.
+     */
+    inline bool put(void* instance)
+    {
+      // claim room for it first so that the shards together never go over.
+      size_t n = pooled.load();
+      do
+      {
+        if (n >= maxPooled)
+          return false;
+      } while (!pooled.compare_exchange_weak(n, n + 1));
+
+      Shard& shard = shards[threadStripe()];
+      std::lock_guard<std::mutex> lock(shard.lock);
+      if (!shard.opened)
+      {
+        pooled.fetch_sub(1);
+        return false;
+      }
+      shard.free.push_back(instance);
+      return true;
+    }
+
+    inline void open()
+    {
+      for (int i = 0; i < numShards; i++)
+      {
+        std::lock_guard<std::mutex> lock(shards[i].lock);
+        shards[i].opened = true;
+      }
+    }
+
+    /**
+     * Closes the pool and hands back everything that was in it.
+     */
+    inline void close(std::vector<void*>& drained)
+    {
+      for (int i = 0; i < numShards; i++)
+      {
+        std::lock_guard<std::mutex> lock(shards[i].lock);
+        shards[i].opened = false;
+        drained.insert(drained.end(), shards[i].free.begin(), shards[i].free.end());
+        pooled.fetch_sub(shards[i].free.size());
+        shards[i].free.clear();
+      }
+    }
+  };
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"direclaimer.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * Keeps track of readers so that anything a writer unpublishes is only freed
+   *  once no reader can still be looking at it. Readers never block. They bump a
+   *  counter (one of several, so that readers on different cores don't fight over
+   *  the same cache line) for as long as they're reading.
+   *
+   * Readers count against the epoch they started in. A writer publishes it's new
+   *  data, then 'retire's the old, which remembers the epoch it was retired in.
+   *  The epoch only moves on once every reader from the one before it has left,
+   *  so two epochs later none of the readers that could have seen the old data
+   *  are left and it's freed. That happens on whichever thread (a writer or the
+   *  last of those readers) first notices, so retired memory doesn't wait for a
+   *  moment with no readers at all, which a busy reader might never give it.
+   */
+  class Reclaimer : public NoCopy
+  {
+  public:
+    typedef void (*Deleter)(void*);
+
+  private:
+    enum { numStripes = numThreadStripes };
+
+    struct Stripe
+    {
+      std::atomic<unsigned int> readers;
+      char pad[64 - sizeof(std::atomic<unsigned int>)];
+    };
+
+    struct Retired
+    {
+      void* ptr;
+      Deleter deleter;
+      unsigned long long epoch;
+    };
+
+    // readers that started in an even or odd epoch
+    mutable Stripe stripes[2][numStripes];
+    mutable std::atomic<unsigned long long> epoch;
+    mutable std::atomic<size_t> pending; // retired but not yet freed
+    mutable std::atomic<bool> wanted; // something changed while 'collect' was busy
+    mutable std::mutex retiredLock;
+    mutable std::vector<Retired> retired;
+
+    inline bool drained(unsigned int parity) const
+    {
+      for (int i = 0; i < numStripes; i++)
+        if (stripes[parity][i].readers.load() != 0)
+          return false;
+      return true;
+    }
+
+    /**
+     * Moves the epoch on as far as the readers allow and frees whatever they can
+     *  no longer see. Never waits: if another thread is already at it then that
+     *  thread goes around again.
+     */
+    inline void collect() const
+    {
+      wanted.store(true);
+      while (pending.load() > 0 && retiredLock.try_lock())
+      {
+        wanted.store(false);
+
+        unsigned long long e = epoch.load();
+        for (int i = 0; i < 2 && drained((unsigned int)((e + 1) & 1)); i++)
+          epoch.store(++e);
+
+        std::vector<Retired> toFree;
+        std::vector<Retired>::iterator keep = retired.begin();
+        for (std::vector<Retired>::iterator it = retired.begin(); it != retired.end(); it++)
+          if (it->epoch + 2 <= e)
+            toFree.push_back(*it);
+          else
+            *(keep++) = *it;
+        retired.erase(keep, retired.end());
+        pending.store(retired.size());
+        retiredLock.unlock();
+
+        for (std::vector<Retired>::iterator it = toFree.begin(); it != toFree.end(); it++)
+          (*(it->deleter))(it->ptr);
+
+        if (!wanted.load())
+          break;
+      }
+    }
+
+  public:
+    inline Reclaimer() : epoch(0), pending(0), wanted(false)
+    {
+      for (int i = 0; i < numStripes; i++)
+        stripes[0][i].readers = stripes[1][i].readers = 0;
+    }
+
+    // no readers can exist once the owner is being destroyed.
+    inline ~Reclaimer() { reclaim(true); }
+
+    /**
+     * RAII marker for a reader. Anything the reader loads while one of these is
+     *  alive stays valid until it goes away.
+     */
+    class Guard
+    {
+      const Reclaimer* reclaimer;
+      std::atomic<unsigned int>* readers;
+
+      Guard& operator=(const Guard&);
+
+    public:
+      inline explicit Guard(const Reclaimer& r) : reclaimer(&r)
+      {
+        unsigned int stripe = threadStripe();
+        for (;;)
+        {
+          unsigned long long e = reclaimer->epoch.load();
+          readers = &(reclaimer->stripes[e & 1][stripe].readers);
+          readers->fetch_add(1);
+          // counted against 'e' only if the epoch didn't move on in the meantime.
+          if (reclaimer->epoch.load() == e)
+            break;
+          readers->fetch_sub(1);
+        }
+      }
+
+      // the original keeps it's epoch from moving on so the copy can join it.
+      inline Guard(const Guard& o) : reclaimer(o.reclaimer), readers(o.readers) { readers->fetch_add(1); }
+
+      inline ~Guard()
+      {
+        readers->fetch_sub(1);
+        if (reclaimer->pending.load() > 0)
+          reclaimer->collect();
+      }
+    };
+
+    /**
+     * Hand memory that has already been unpublished to the reclaimer. It will be
+     *  passed to the deleter once none of the readers that might have seen it are
+     *  left.
+     */
+    inline void retire(void* ptr, Deleter deleter)
+    {
+      {
+        std::lock_guard<std::mutex> lock(retiredLock);
+        Retired r = { ptr, deleter, epoch.load() };
+        retired.push_back(r);
+        pending.store(retired.size());
+      }
+      collect();
+    }
+
+    /**
+     * Frees everything retired so far that no reader could still see. 'force'
+     *  frees all of it and should only be used when there can't be any readers.
+     */
+    inline void reclaim(bool force)
+    {
+      if (!force)
+      {
+        collect();
+        return;
+      }
+
+      std::vector<Retired> toFree;
+      {
+        std::lock_guard<std::mutex> lock(retiredLock);
+        toFree.swap(retired);
+        pending.store(0);
+      }
+
+      for (std::vector<Retired>::iterator it = toFree.begin(); it != toFree.end(); it++)
+        (*(it->deleter))(it->ptr);
+    }
+  };
+
+  /**
+   * Where a swappable Bean (see Bean<T>::swappable) publishes it's current 
+   *  instance. Readers (see di::Swappable) load it while holding a Guard on the
+   *  reclaimer and replacing it retires the old instance to the reclaimer, which
+   *  destroys it once none of those readers are left.
+   */
+  class SwapCell : public NoCopy
+  {
+  public:
+    std::atomic<void*> current;
+    Reclaimer reclaimer;
+    std::mutex swapLock; // held by whoever's replacing the instance
+
+    inline SwapCell() : current(NULL) {}
+  };
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"diregistry.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * The list of Beans declared in a Context. Readers are lock free and see an
+   *  immutable snapshot of the list. Writers are serialized and publish a new
+   *  snapshot atomically.
+   *
+   * Beans are only ever appended (or all removed at once) so successive snapshots
+   *  share the same storage until it needs to grow. A snapshot simply doesn't look
+   *  beyond its own count.
+   *
+   * An index from each type to the Beans that provide it (via isAlso) can be built
+   *  once the declarations are complete (see 'buildIndex'). It becomes part of the
+   *  published snapshots until the next write.
+   *
+   * Alongside the Beans the registry keeps a copy of what a lookup compares (each
+   *  Bean's type tag, type and id) in arrays of their own. A scan streams through 
+   *  just those and only touches a Bean when it matches. How each Bean was scoped
+   *  is kept the same way so that the lifecycle passes only touch the Beans they
+   *  apply to.
+   */
+  class Registry : public NoCopy
+  {
+  public:
+    /**
+     * The Beans that provide a type, and what lookups check about each of them.
+     */
+    struct Provided
+    {
+      std::vector<BeanBase*> beans;
+      std::vector<Symbol> ids;
+      std::vector<unsigned char> exact; // the Bean's own type is the one provided
+    };
+
+    typedef std::unordered_map<std::type_index, Provided> Index;
+
+    /**
+     * How a Bean was declared, as the bits of it's entry in the scopes column.
+     */
+    enum Scope { prototype = 1, lazy = 2, root = 4, sideEffects = 8, afterFork = 16 };
+
+    static inline unsigned char scopesOf(const BeanBase* bean)
+    {
+      return (unsigned char)((bean->isPrototype() ? prototype : 0) | (bean->isLazy() ? lazy : 0) | (bean->isRoot() ? root : 0) |
+        (bean->hasSideEffects() ? sideEffects : 0) | (bean->isAfterFork() ? afterFork : 0));
+    }
+
+  private:
+    struct Columns : public NoCopy
+    {
+      BeanBase** beans;
+      TypeTag* tags; // of each Bean's own type
+      const std::type_info** types; // each Bean's own type
+      Symbol* ids;
+      unsigned char* scopes;
+
+      inline explicit Columns(size_t capacity) : beans(new BeanBase*[capacity]), tags(new TypeTag[capacity]), 
+        types(new const std::type_info*[capacity]), ids(new Symbol[capacity]), scopes(new unsigned char[capacity]) {}
+      inline ~Columns() { delete [] beans; delete [] tags; delete [] types; delete [] ids; delete [] scopes; }
+
+      inline void set(size_t i, BeanBase* bean) { beans[i] = bean; tags[i] = bean->tag; types[i] = bean->type; ids[i] = bean->id; scopes[i] = scopesOf(bean); }
+    };
+
+    struct Snapshot
+    {
+      BeanBase** beans;
+      const TypeTag* tags;
+      const std::type_info* const* types;
+      const Symbol* ids;
+      const unsigned char* scopes;
+      size_t count;
+      const Index* index;
+    };
+
+    std::atomic<Snapshot*> current;
+
+    // writer side, guarded by writeLock
+    std::mutex writeLock;
+    Columns* storage;
+    size_t capacity;
+    size_t count;
+    Index* index;
+
+    // the types declared with each id, guarded by writeLock
+    typedef std::unordered_map<Symbol, std::vector<const std::type_info*> > Ids;
+    Ids ids;
+
+    Reclaimer reclaimer;
+
+    static inline void deleteSnapshot(void* p) { delete (Snapshot*)p; }
+    static inline void deleteStorage(void* p) { delete (Columns*)p; }
+    static inline void deleteBean(void* p) { delete (BeanBase*)p; }
+    static inline void deleteIndex(void* p) { delete (Index*)p; }
+
+    inline void dropIndexLocked()
+    {
+      if (index)
+        reclaimer.retire(index, &deleteIndex);
+      index = NULL;
+    }
+
+    inline void publish()
+    {
+      Snapshot* next = new Snapshot;
+      next->beans = storage ? storage->beans : NULL;
+      next->tags = storage ? storage->tags : NULL;
+      next->types = storage ? storage->types : NULL;
+      next->ids = storage ? storage->ids : NULL;
+      next->scopes = storage ? storage->scopes : NULL;
+      next->count = count;
+      next->index = index;
+      Snapshot* prev = current.exchange(next);
+      if (prev)
+        reclaimer.retire(prev, &deleteSnapshot);
+    }
+
+    static inline bool declared(Ids& in, const BeanBase* bean)
+    {
+      Ids::iterator found = in.find(bean->id);
+      if (found != in.end())
+        for (std::vector<const std::type_info*>::iterator it = found->second.begin(); it != found->second.end(); it++)
+          if (*(*it) == *(bean->type))
+            return true;
+      return false;
+    }
+
+    inline void reserveLocked(size_t needed)
+    {
+      if (needed <= capacity)
+        return;
+
+      size_t newCapacity = capacity ? capacity : 16;
+      while (newCapacity < needed)
+        newCapacity *= 2;
+
+      Columns* newStorage = new Columns(newCapacity);
+      for (size_t i = 0; i < count; i++)
+        newStorage->set(i, storage->beans[i]);
+
+      // current readers may still be looking at the old storage.
+      if (storage)
+        reclaimer.retire(storage, &deleteStorage);
+      storage = newStorage;
+      capacity = newCapacity;
+    }
+
+  public:
+    typedef BeanBase* const* iterator;
+
+    /**
+     * A reader's view of the registry. The beans in it stay valid for as long
+     *  as the view exists, regardless of what writers do in the meantime.
+     */
+    class View
+    {
+      Reclaimer::Guard guard;
+      const Snapshot* snapshot;
+
+    public:
+      inline explicit View(const Registry& registry) : guard(registry.reclaimer), snapshot(registry.current.load()) {}
+
+      inline iterator begin() const { return snapshot->beans; }
+      inline iterator end() const { return snapshot->beans + snapshot->count; }
+      inline size_t size() const { return snapshot->count; }
+      inline BeanBase* operator[](size_t index) const { return snapshot->beans[index]; }
+
+      /**
+       * The type tag, type, id and scopes (see Scope) of each Bean, in the same 
+       *  order. The scopes are only certain from the last 'buildIndex' on.
+       */
+      inline const TypeTag* tags() const { return snapshot->tags; }
+      inline const std::type_info* const* types() const { return snapshot->types; }
+      inline const Symbol* ids() const { return snapshot->ids; }
+      inline const unsigned char* scopes() const { return snapshot->scopes; }
+
+      inline bool indexed() const { return snapshot->index != NULL; }
+
+      /**
+       * The Beans that provide the given type, or NULL if there are none. Only
+       *  meaningful when 'indexed()'
+       */
+      inline const Provided* provides(const std::type_info& type) const
+      {
+        Index::const_iterator found = snapshot->index->find(std::type_index(type));
+        return found == snapshot->index->end() ? NULL : &(found->second);
+      }
+    };
+
+    inline Registry() : current(NULL), storage(NULL), capacity(0), count(0), index(NULL) { publish(); }
+
+    inline ~Registry()
+    {
+      delete current.load();
+      if (storage)
+        delete storage;
+      if (index)
+        delete index;
+    }
+
+    inline View view() const { return View(*this); }
+
+    inline Reclaimer& getReclaimer() { return reclaimer; }
+
+    /**
+     * Appends a Bean and publishes the result.
+     */
+    inline void add(BeanBase* bean) { append(&bean, 1); }
+
+    /**
+     * Appends all of the Beans and publishes the result once. Unlike 'addAll' the
+     *  ids aren't checked.
+     */
+    inline void append(BeanBase* const* beans, size_t n)
+    {
+      std::lock_guard<std::mutex> lock(writeLock);
+      reserveLocked(count + n);
+      for (size_t i = 0; i < n; i++)
+      {
+        storage->set(count++, beans[i]);
+        if (beans[i]->hasId())
+          ids[beans[i]->id].push_back(beans[i]->type);
+      }
+      dropIndexLocked();
+      publish();
+    }
+
+    /**
+     * Appends all of the Beans and publishes the result once. This is linear in
+     *  'n'. If any of them has the same id and type as another one (in 'beans' or
+     *  already added) then this throws and nothing is added.
+     */
+    inline void addAll(BeanBase* const* beans, size_t n) /* throw (DependencyInjectionException) */
+    {
+      std::lock_guard<std::mutex> lock(writeLock);
+      Ids pending;
+      for (size_t i = 0; i < n; i++)
+      {
+        BeanBase* bean = beans[i];
+        if (!bean->hasId())
+          continue;
+        if (declared(ids, bean) || declared(pending, bean))
+          DI_FAIL(, Status::badDeclaration, bean->toString(), std::string(), "\"%s\" is declared more than once.", bean->toString().c_str());
+        pending[bean->id].push_back(bean->type);
+      }
+
+      reserveLocked(count + n);
+      for (size_t i = 0; i < n; i++)
+        storage->set(count++, beans[i]);
+      for (Ids::iterator it = pending.begin(); it != pending.end(); it++)
+        ids[it->first].insert(ids[it->first].end(), it->second.begin(), it->second.end());
+      dropIndexLocked();
+      publish();
+    }
+
+    /**
+     * The bytes used by the registry's own book keeping (not including the Beans).
+     *  The index is estimated since the hash map's nodes aren't visible.
+     */
+    inline size_t footprint()
+    {
+      std::lock_guard<std::mutex> lock(writeLock);
+      size_t ret = sizeof(*this) + sizeof(Snapshot) + (storage ? sizeof(Columns) : 0) + 
+        capacity * (sizeof(BeanBase*) + sizeof(TypeTag) + sizeof(std::type_info*) + sizeof(Symbol) + sizeof(unsigned char));
+      if (index)
+      {
+        ret += sizeof(Index) + index->bucket_count() * sizeof(void*);
+        for (Index::const_iterator it = index->begin(); it != index->end(); it++)
+          ret += sizeof(Index::value_type) + 2 * sizeof(void*) + it->second.beans.capacity() * sizeof(BeanBase*) +
+            it->second.ids.capacity() * sizeof(Symbol) + it->second.exact.capacity();
+      }
+      return ret;
+    }
+
+    /**
+     * Builds the type index over the current Beans and publishes it. The scopes
+     *  are brought up to date too since a Bean can still be declared lazy (for 
+     *  example) once it's been added.
+     */
+    inline void buildIndex()
+    {
+      std::lock_guard<std::mutex> lock(writeLock);
+      Index* next = new Index;
+      for (size_t i = 0; i < count; i++)
+      {
+        BeanBase* bean = storage->beans[i];
+        storage->scopes[i] = scopesOf(bean);
+        for (BeanBase::Converters::iterator it = bean->isAlsoTheseInstances.begin(); 
+             it != bean->isAlsoTheseInstances.end(); it++)
+        {
+          Provided& provided = (*next)[std::type_index((*it)->getInstanceInfo())];
+          provided.beans.push_back(bean);
+          provided.ids.push_back(bean->id);
+          provided.exact.push_back(*(bean->type) == (*it)->getInstanceInfo());
+        }
+      }
+
+      dropIndexLocked();
+      index = next;
+      publish();
+    }
+
+    /**
+     * Removes (and eventually deletes, unless 'deleteBeans' is false) every Bean.
+     */
+    inline void clear(bool deleteBeans = true)
+    {
+      std::lock_guard<std::mutex> lock(writeLock);
+      Columns* oldStorage = storage;
+      size_t oldCount = count;
+
+      storage = NULL;
+      capacity = 0;
+      count = 0;
+      ids.clear();
+      dropIndexLocked();
+      publish();
+
+      for (size_t i = 0; deleteBeans && i < oldCount; i++)
+        reclaimer.retire(oldStorage->beans[i], &deleteBean);
+      if (oldStorage)
+        reclaimer.retire(oldStorage, &deleteStorage);
+    }
+  };
+}
@@ -21,7 +21,9 @@ namespace internal
 
     inline Requirement(const D& ty, typename Setter<T,RDT>::type func) : setter(func), parameter(ty) {}
   protected:
-    inline virtual void satisfy(BeanBase* instance, Context* context) /* throw (DependencyInjectionException) */;
+    inline virtual size_t footprint() const { return sizeof(*this); }
+    inline virtual void dependencies(Dependencies& ret) const { ret.push_back(Dependency(parameter, Dependency::setter)); }
+    inline virtual void satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */;
   };
 
   template<class T, class D, class RDT> class RequirementConstant : public internal::RequirementBase
@@ -33,20 +35,82 @@ namespace internal
 
     inline RequirementConstant(const D& ty, typename Setter<T,RDT>::type func) : setter(func), parameter(ty) {}
   protected:
-    inline virtual void satisfy(BeanBase* instance, Context* context) /* throw (DependencyInjectionException) */;
+    inline virtual size_t footprint() const { return sizeof(*this); }
+    inline virtual void dependencies(Dependencies& /*ret*/) const {}
+    inline virtual void satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */;
   };
 
+  // see diimpl.h
+  template<class RDT> struct CollectAll;
   
-  template<class T, class D, class RDT> class RequirementAll : public internal::RequirementBase
+  /**
+   * S is the type of the setter. See SetterAll, SetterAllRef etc.
+   */
+  template<class T, class D, class RDT, class S> class RequirementAll : public internal::RequirementBase
   {
     friend class di::Bean<T>;
 
-    typename SetterAll<T,RDT>::type setter;
+    S setter;
     D parameter;
 
-    inline RequirementAll(const D& ty, typename SetterAll<T,RDT>::type func) : setter(func), parameter(ty) {}
+    inline RequirementAll(const D& ty, S func) : setter(func), parameter(ty) {}
   protected:
-    inline virtual void satisfy(BeanBase* instance, Context* context) /* throw (DependencyInjectionException) */;
+    inline virtual size_t footprint() const { return sizeof(*this); }
+    inline virtual void dependencies(Dependencies& ret) const { ret.push_back(Dependency(parameter, Dependency::all)); }
+    inline virtual void satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */;
   };
-}
 
+  /**
+   * Injects a Provider<D> rather than a D*. S is the type of the setter. See 
+   *  SetterProvider and SetterProviderRef.
+   */
+  template<class T, class D, class S> class RequirementProvider : public internal::RequirementBase
+  {
+    friend class di::Bean<T>;
+
+    S setter;
+    Instance<D> parameter;
+
+    inline RequirementProvider(const Instance<D>& ty, S func) : setter(func), parameter(ty) {}
+  protected:
+    inline virtual size_t footprint() const { return sizeof(*this); }
+    inline virtual void dependencies(Dependencies& ret) const { ret.push_back(Dependency(parameter, Dependency::provider)); }
+    inline virtual void satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */;
+  };
+
+  /**
+   * Injects a Replicas<D> for a replicated D. S is the type of the setter. See 
+   *  SetterReplicas and SetterReplicasRef.
+   */
+  template<class T, class D, class S> class RequirementReplicas : public internal::RequirementBase
+  {
+    friend class di::Bean<T>;
+
+    S setter;
+    Instance<D> parameter;
+
+    inline RequirementReplicas(const Instance<D>& ty, S func) : setter(func), parameter(ty) {}
+  protected:
+    inline virtual size_t footprint() const { return sizeof(*this); }
+    inline virtual void dependencies(Dependencies& ret) const { ret.push_back(Dependency(parameter, Dependency::replicas)); }
+    inline virtual void satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */;
+  };
+
+  /**
+   * Injects a Swappable<D> for a swappable D. S is the type of the setter. See 
+   *  SetterSwappable and SetterSwappableRef.
+   */
+  template<class T, class D, class S> class RequirementSwappable : public internal::RequirementBase
+  {
+    friend class di::Bean<T>;
+
+    S setter;
+    Instance<D> parameter;
+
+    inline RequirementSwappable(const Instance<D>& ty, S func) : setter(func), parameter(ty) {}
+  protected:
+    inline virtual size_t footprint() const { return sizeof(*this); }
+    inline virtual void dependencies(Dependencies& ret) const { ret.push_back(Dependency(parameter, Dependency::swappable)); }
+    inline virtual void satisfy(BeanBase* instance, void* concrete, Context* context) /* throw (DependencyInjectionException) */;
+  };
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"discan.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * Scans over the registry's columns (see Registry::Columns). Each returns the
+   *  position of the first match in [from,to), or 'to' if there isn't one. With
+   *  SSE2 they compare 16 bytes at a time.
+   */
+  inline size_t findTag(const TypeTag* tags, size_t from, size_t to, TypeTag tag)
+  {
+    size_t i = from;
+#ifdef DI_SSE2
+    const __m128i wanted = _mm_set1_epi32((int)tag);
+    for (; i + 4 <= to; i += 4)
+    {
+      int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(tags + i)), wanted)));
+      if (mask != 0)
+        return i + ((mask & 1) ? 0 : (mask & 2) ? 1 : (mask & 4) ? 2 : 3);
+    }
+#endif
+    for (; i < to; i++)
+      if (tags[i] == tag)
+        return i;
+    return to;
+  }
+
+  inline size_t findSymbol(const Symbol* ids, size_t from, size_t to, Symbol id)
+  {
+    size_t i = from;
+#ifdef DI_SSE2
+    if (sizeof(Symbol) == 8)
+    {
+      // SSE2 only compares 32 bits at a time so a pointer matches when both halves do.
+      unsigned long long bits = (unsigned long long)(std::uintptr_t)id;
+      const __m128i wanted = _mm_set_epi32((int)(bits >> 32), (int)bits, (int)(bits >> 32), (int)bits);
+      for (; i + 2 <= to; i += 2)
+      {
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(ids + i)), wanted)));
+        if ((mask & 3) == 3)
+          return i;
+        if ((mask & 12) == 12)
+          return i + 1;
+      }
+    }
+#endif
+    for (; i < to; i++)
+      if (ids[i] == id)
+        return i;
+    return to;
+  }
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"disnapshot.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * A checkpoint of the state of the checkpointed Beans (see Bean<T>::checkpointed)
+   *  as it's laid out in the file: a header, a table of entries and then each
+   *  entry's state, aligned so that it can be used in place. Entries are keyed on
+   *  a hash of the Bean's declaration (see 'key') so state is only ever restored
+   *  into the same declaration that saved it.
+   *
+   * The file is only meant to be read back by the same build on the same machine so
+   *  it's in the native byte order. Where it can be, it's mapped into memory rather
+   *  than read so restoring doesn't copy the state, and it stays mapped until the
+   *  instances restored from it are deleted.
+   */
+  class Snapshot : public NoCopy
+  {
+    struct Header
+    {
+      char magic[8];
+      unsigned long long count;
+    };
+
+    struct Entry
+    {
+      unsigned long long key;
+      unsigned long long offset; // from the start of the file
+      unsigned long long size;
+    };
+
+    static const size_t alignment = 16;
+
+    const char* data;
+    size_t size;
+    bool mapped;
+    std::vector<char> copy; // when it couldn't be mapped
+
+    static inline const char* magic() { return "dichk1"; }
+    static inline unsigned long long aligned(unsigned long long offset) { return (offset + alignment - 1) & ~(unsigned long long)(alignment - 1); }
+
+    inline const Entry* entries() const { return (const Entry*)(data + sizeof(Header)); }
+    inline size_t count() const { return data == NULL ? 0 : (size_t)((const Header*)data)->count; }
+
+    inline bool valid() const
+    {
+      if (size < sizeof(Header) || std::strncmp(((const Header*)data)->magic, magic(), sizeof(Header::magic)) != 0)
+        return false;
+      unsigned long long n = ((const Header*)data)->count;
+      if (n > (size - sizeof(Header)) / sizeof(Entry))
+        return false;
+      for (size_t i = 0; i < n; i++)
+        if (entries()[i].offset > size || entries()[i].size > size - entries()[i].offset)
+          return false;
+      return true;
+    }
+
+  public:
+    /**
+     * A saved state and the key it's saved under.
+     */
+    typedef std::pair<unsigned long long, std::string> State;
+
+    inline Snapshot() : data(NULL), size(0), mapped(false) {}
+    inline ~Snapshot() { close(); }
+
+    /**
+     * Where instance 'i' of 'bean' is kept. 'definition' is the hash of the Bean's
+     *  declaration (see StartPlan::hashBean), mixed with which of the declarations
+     *  that hash the same it is so that they don't share a key.
+     */
+    static inline unsigned long long key(unsigned long long definition, unsigned int i) { return hashBytes((const char*)&i, sizeof(i), definition); }
+
+    /**
+     * Opens the checkpoint at 'path'. Returns false, leaving this empty, if there is
+     *  no such file or it isn't a checkpoint.
+     */
+    inline bool open(const std::string& path)
+    {
+      close();
+#ifdef DI_MMAP
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd >= 0)
+      {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+          void* at = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (at != MAP_FAILED)
+          {
+            data = (const char*)at;
+            size = (size_t)st.st_size;
+            mapped = true;
+          }
+        }
+        ::close(fd);
+      }
+#endif
+      if (data == NULL)
+      {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (copy.size() > 0)
+        {
+          data = &copy[0];
+          size = copy.size();
+        }
+      }
+
+      if (data != NULL && !valid())
+        close();
+      return data != NULL;
+    }
+
+    inline void close()
+    {
+#ifdef DI_MMAP
+      if (mapped)
+        munmap((void*)data, size);
+#endif
+      data = NULL;
+      size = 0;
+      mapped = false;
+      std::vector<char>().swap(copy);
+    }
+
+    inline bool isOpen() const { return data != NULL; }
+
+    /**
+     * Finds the state saved under 'key'. Returns false if there isn't any.
+     */
+    inline bool find(unsigned long long key, const char*& state, size_t& stateSize) const
+    {
+      for (size_t i = 0; i < count(); i++)
+        if (entries()[i].key == key)
+        {
+          state = data + entries()[i].offset;
+          stateSize = (size_t)entries()[i].size;
+          return true;
+        }
+      return false;
+    }
+
+    /**
+     * Writes 'states' to 'path'. It's written to a temporary file first and then
+     *  renamed over 'path' so that a checkpoint that's mapped (possibly the one
+     *  being replaced) is never changed underneath it's readers. Returns false if
+     *  it couldn't be written.
+     */
+    static inline bool save(const std::string& path, const std::vector<State>& states)
+    {
+      std::string tmp = path + ".tmp";
+      {
+        std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::strncpy(header.magic, magic(), sizeof(header.magic));
+        header.count = states.size();
+        out.write((const char*)&header, sizeof(header));
+
+        unsigned long long offset = aligned(sizeof(Header) + states.size() * sizeof(Entry));
+        for (std::vector<State>::const_iterator it = states.begin(); it != states.end(); it++)
+        {
+          Entry entry = { it->first, offset, it->second.size() };
+          out.write((const char*)&entry, sizeof(entry));
+          offset = aligned(offset + it->second.size());
+        }
+
+        static const char padding[alignment] = { 0 };
+        unsigned long long at = sizeof(Header) + states.size() * sizeof(Entry);
+        for (std::vector<State>::const_iterator it = states.begin(); it != states.end(); it++)
+        {
+          out.write(padding, (std::streamsize)(aligned(at) - at));
+          out.write(it->second.data(), (std::streamsize)it->second.size());
+          at = aligned(at) + it->second.size();
+        }
+
+        out.close();
+        if (out.fail())
+        {
+          std::remove(tmp.c_str());
+          return false;
+        }
+      }
+
+#ifndef DI_MMAP
+      // only POSIX renames over an existing file.
+      std::remove(path.c_str());
+#endif
+      if (std::rename(tmp.c_str(), path.c_str()) != 0)
+      {
+        std::remove(tmp.c_str());
+        return false;
+      }
+      return true;
+    }
+  };
+}
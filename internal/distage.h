@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"distage.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * Beans a Context has been given by 'has' but hasn't added to it's Registry yet.
+   *  Each thread declaring into the Context gets a Stage of it's own so threads
+   *  declaring at the same time don't wait on each other, or on a Registry publish
+   *  per Bean. A Stage is merged into the Registry in one go (see Registry::append).
+   *
+   * Finding the calling thread's Stage is a thread local comparison once the thread
+   *  has found it the first time. Stages are only added, to a lock free list, and
+   *  live as long as the Staging does.
+   */
+  class Staging : public NoCopy
+  {
+    struct Stage
+    {
+      std::thread::id owner;
+      std::mutex lock; // only contended while the Stage is being merged
+      std::vector<BeanBase*> beans;
+      Stage* next;
+    };
+
+    std::atomic<Stage*> stages;
+    std::atomic<size_t> staged; // over all of the Stages
+    unsigned long long serial; // tells this Staging apart from any earlier one at the same address
+
+    static inline unsigned long long nextSerial() { static std::atomic<unsigned long long> next(1); return next.fetch_add(1); }
+
+    // NULL if the calling thread doesn't have one and 'create' is false
+    inline Stage* own(bool create)
+    {
+      struct Cached { unsigned long long serial; Stage* stage; };
+      static thread_local Cached cached = { 0, NULL };
+      if (cached.serial == serial)
+        return cached.stage;
+
+      std::thread::id me = std::this_thread::get_id();
+      Stage* found = stages.load();
+      while (found != NULL && found->owner != me)
+        found = found->next;
+
+      if (found == NULL && !create)
+        return NULL;
+      if (found == NULL)
+      {
+        found = new Stage;
+        found->owner = me;
+        found->next = stages.load();
+        while (!stages.compare_exchange_weak(found->next, found)) {}
+      }
+
+      cached.serial = serial;
+      cached.stage = found;
+      return found;
+    }
+
+    inline void take(Stage* stage, std::vector<BeanBase*>& ret)
+    {
+      std::lock_guard<std::mutex> guard(stage->lock);
+      ret.insert(ret.end(), stage->beans.begin(), stage->beans.end());
+      staged.fetch_sub(stage->beans.size());
+      stage->beans.clear();
+    }
+
+  public:
+    inline Staging() : stages(NULL), staged(0), serial(nextSerial()) {}
+
+    inline ~Staging()
+    {
+      for (Stage* stage = stages.load(); stage != NULL; )
+      {
+        Stage* next = stage->next;
+        delete stage;
+        stage = next;
+      }
+    }
+
+    inline void stage(BeanBase* bean)
+    {
+      Stage* mine = own(true);
+      std::lock_guard<std::mutex> guard(mine->lock);
+      mine->beans.push_back(bean);
+      staged.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * Whether any thread has Beans staged. This is what lookups check so it's
+     *  only a load.
+     */
+    inline bool any() const { return staged.load(std::memory_order_acquire) != 0; }
+
+    /**
+     * Moves the calling thread's staged Beans, or every thread's, to 'ret' in the
+     *  order they were declared (per thread).
+     */
+    inline void takeOwn(std::vector<BeanBase*>& ret) { Stage* mine = own(false); if (mine != NULL) take(mine, ret); }
+
+    inline void takeAll(std::vector<BeanBase*>& ret)
+    {
+      for (Stage* stage = stages.load(); stage != NULL; stage = stage->next)
+        take(stage, ret);
+    }
+  };
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"distats.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * Event counters for a Context that cost next to nothing when they're turned off
+   *  (a relaxed load and a branch) and not much more when they're on. Each thread
+   *  counts into it's own stripe (see threadStripe) so that threads doing lookups
+   *  on different cores aren't fighting over a cache line. The stripes are summed
+   *  when the counters are read.
+   */
+  class Counters : public NoCopy
+  {
+  public:
+    enum Counter { finds = 0, findAlls, candidatesScanned, conversions, lazyCreated, acquired, numCounters };
+
+  private:
+    struct Stripe
+    {
+      std::atomic<unsigned long long> counts[numCounters];
+      char pad[64 - ((sizeof(std::atomic<unsigned long long>) * numCounters) % 64)];
+    };
+
+    std::atomic<bool> enabled;
+    Stripe stripes[numThreadStripes];
+
+  public:
+    inline Counters() : enabled(false) { reset(); }
+
+    inline void enable(bool on) { enabled.store(on, std::memory_order_relaxed); }
+    inline bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    inline void count(Counter counter, unsigned long long n = 1)
+    {
+      if (enabled.load(std::memory_order_relaxed))
+        stripes[threadStripe()].counts[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    inline unsigned long long total(Counter counter) const
+    {
+      unsigned long long ret = 0;
+      for (int i = 0; i < numThreadStripes; i++)
+        ret += stripes[i].counts[counter].load(std::memory_order_relaxed);
+      return ret;
+    }
+
+    inline void reset()
+    {
+      for (int i = 0; i < numThreadStripes; i++)
+        for (int c = 0; c < numCounters; c++)
+          stripes[i].counts[c].store(0, std::memory_order_relaxed);
+    }
+  };
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#pragma once
+
+// This file should NEVER be included independently. It is part of the internals of
+//   the di.h file and simply separated
+#ifndef DI__DEPENDENCY_INJECTION__H
+#error "Please don't include \"disymbol.h\" directly."
+#endif
+
+namespace internal
+{
+  /**
+   * An interned string. Two Symbols are the same string if, and only if, they are
+   *  the same pointer. NULL is "no symbol."
+   */
+  typedef const std::string* Symbol;
+
+  /**
+   * FNV-1a, usable at compile time so that ids that are literals (see DI_ID) don't
+   *  need hashing at runtime.
+   */
+  constexpr inline unsigned long long hashSymbol(const char* str, size_t len, unsigned long long hash = 14695981039346656037ULL)
+  {
+    return len == 0 ? hash : hashSymbol(str + 1, len - 1, (hash ^ (unsigned long long)(unsigned char)(*str)) * 1099511628211ULL);
+  }
+
+  /**
+   * The same hash as hashSymbol but a loop, for strings that aren't known at 
+   *  compile time (and can be long).
+   */
+  inline unsigned long long hashBytes(const char* str, size_t len, unsigned long long hash = 14695981039346656037ULL)
+  {
+    for (size_t i = 0; i < len; i++)
+      hash = (hash ^ (unsigned long long)(unsigned char)str[i]) * 1099511628211ULL;
+    return hash;
+  }
+
+  /**
+   * The process wide table of interned ids. Interning takes a (short) lock but
+   *  comparing Symbols afterward is just comparing pointers. Symbols live for the
+   *  life of the process, the same as string literals.
+   */
+  class SymbolTable
+  {
+    std::mutex lock;
+    std::unordered_map<unsigned long long, std::vector<Symbol> > table;
+
+    inline SymbolTable() {}
+    SymbolTable(const SymbolTable&);
+    SymbolTable& operator=(const SymbolTable&);
+
+    // never deleted so that Symbols stay valid through static destruction.
+    static inline SymbolTable& get() { static SymbolTable* instance = new SymbolTable; return *instance; }
+
+  public:
+    static inline Symbol intern(const char* str, size_t len) { return intern(str, len, hashBytes(str, len)); }
+
+    /**
+     * 'hash' must be hashBytes(str,len) (or hashSymbol, which is the same)
+     */
+    static inline Symbol intern(const char* str, size_t len, unsigned long long hash)
+    {
+      SymbolTable& symbols = get();
+      std::lock_guard<std::mutex> guard(symbols.lock);
+      std::vector<Symbol>& bucket = symbols.table[hash];
+      for (std::vector<Symbol>::iterator it = bucket.begin(); it != bucket.end(); it++)
+        if ((*it)->size() == len && (*it)->compare(0, len, str, len) == 0)
+          return *it;
+
+      Symbol ret = new std::string(str, len);
+      bucket.push_back(ret);
+      return ret;
+    }
+  };
+}
@@ -57,6 +57,23 @@ namespace constructorDiTests
     context.stop();
   }
 
+  TEST(ciSeveralWaiting)
+  {
+    Context context;
+    // both wait a pass for Foo
+    context.has(Instance<MyBean>("first"), Instance<Foo>());
+    context.has(Instance<MyBean>("second"), Instance<Foo>());
+    context.has(Instance<Foo>());
+    context.start();
+    Foo* foo = context.get(Instance<Foo>());
+    CHECK(context.get(Instance<MyBean>("first")) != NULL);
+    CHECK(context.get(Instance<MyBean>("second")) != NULL);
+    CHECK(context.get(Instance<MyBean>("first"))->foo == foo);
+    CHECK(context.get(Instance<MyBean>("second"))->foo == foo);
+    CHECK(context.progress().instantiated == 3);
+    context.stop();
+  }
+
   TEST(ci)
   {
     Context context;
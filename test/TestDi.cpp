@@ -6,6 +6,7 @@
 
 #include <UnitTest++/UnitTest++.h>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
 using namespace di;
@@ -519,6 +520,60 @@ namespace vectorTest
     CHECK(foo->bars.size() == 3);
   }
 
+  class Dispatcher
+  {
+  public:
+    std::vector<IBar*> handlers;
+
+    void setHandlersRef(const std::vector<IBar*>& handlers_) { handlers = handlers_; }
+    void setHandlersMove(std::vector<IBar*>&& handlers_) { handlers = std::move(handlers_); }
+  };
+
+  TEST(TestRequiresAllSetterForms)
+  {
+    Context context;
+    context.has("ref",Instance<Dispatcher>()).requiresAll(Instance<IBar>(),&Dispatcher::setHandlersRef);
+    context.has("move",Instance<Dispatcher>()).requiresAll(Instance<IBar>(),&Dispatcher::setHandlersMove);
+    for (int i = 0; i < 1000; i++)
+      context.has(Instance<Bar>()).isAlso(Instance<IBar>());
+    context.start();
+
+    CHECK(context.get(Instance<Dispatcher>(),"ref")->handlers.size() == 1000);
+    CHECK(context.get(Instance<Dispatcher>(),"move")->handlers.size() == 1000);
+  }
+
+  class Named
+  {
+  public:
+    virtual ~Named() {}
+  };
+
+  // IBar isn't at the start of a NamedBar
+  class NamedBar : public Named, public Bar {};
+
+  class User
+  {
+  public:
+    IBar* bar;
+    std::vector<IBar*> bars;
+
+    inline User() : bar(NULL) {}
+    void setBar(IBar* bar_) { bar = bar_; }
+    void setBars(const std::vector<IBar*>& bars_) { bars = bars_; }
+  };
+
+  TEST(TestRequiresSecondBase)
+  {
+    Context context;
+    context.has(Instance<User>()).requires(Instance<IBar>(),&User::setBar).requiresAll(Instance<IBar>(),&User::setBars);
+    context.has(Instance<NamedBar>()).isAlso(Instance<IBar>());
+    context.start();
+
+    IBar* expected = context.get(Instance<NamedBar>());
+    User* user = context.get(Instance<User>());
+    CHECK(user->bar == expected);
+    CHECK(user->bars.size() == 1 && user->bars[0] == expected);
+  }
 }
 
 namespace otherTests
@@ -671,3 +726,1340 @@ namespace circularDependencyTests
     CHECK(foo->bar == bar);
   }
 }
+
+namespace concurrentRegistryTests
+{
+  class Bar
+  {
+  };
+
+  class Foo
+  {
+  };
+
+  TEST(TestGetWhileAdding)
+  {
+    Context context;
+    context.has(Instance<Bar>());
+    context.start();
+    Bar* bar = context.get(Instance<Bar>());
+    CHECK(bar != nullptr);
+
+    std::atomic<bool> done(false);
+    std::atomic<int> mismatches(0);
+    std::thread reader([&]()
+    {
+      while (!done)
+        if (context.get(Instance<Bar>()) != bar)
+          mismatches++;
+    });
+
+    for (int i = 0; i < 1000; i++)
+      context.has(Instance<Foo>());
+
+    done = true;
+    reader.join();
+    CHECK(mismatches == 0);
+  }
+
+  class IBar
+  {
+  public:
+    virtual ~IBar() {}
+  };
+
+  class Baz : public IBar
+  {
+  public:
+    Bar* bar;
+    inline Baz() : bar(NULL) {}
+    void setBar(Bar* b) { bar = b; }
+  };
+
+  TEST(TestDeclareFromManyThreads)
+  {
+    Context context;
+    context.has(Instance<Bar>());
+    CHECK(context.find(Instance<Bar>()) != NULL);
+
+    std::atomic<int> unseen(0);
+    std::vector<std::thread> declarers;
+    for (int t = 0; t < 8; t++)
+      declarers.push_back(std::thread([&context, &unseen, t]()
+      {
+        for (int i = 0; i < 200; i++)
+        {
+          char id[32];
+          snprintf(id, sizeof(id), "baz-%d-%d", t, i);
+          context.has(id, Instance<Baz>()).isAlso(Instance<IBar>()).requires(Instance<Bar>(), &Baz::setBar);
+        }
+        // each thread sees what it declared
+        char mine[32];
+        snprintf(mine, sizeof(mine), "baz-%d-0", t);
+        if (context.find(Instance<Baz>(), mine) == NULL)
+          unseen++;
+      }));
+    for (std::vector<std::thread>::iterator it = declarers.begin(); it != declarers.end(); it++)
+      it->join();
+    CHECK(unseen == 0);
+
+    context.start();
+    std::vector<internal::BeanBase*> bazes;
+    context.findAll(bazes, Instance<IBar>(), Id(), false);
+    CHECK(bazes.size() == 1600);
+    Baz* last = context.get(Instance<Baz>(), "baz-7-199");
+    CHECK(last != NULL && last->bar == context.get(Instance<Bar>()));
+    context.stop();
+  }
+
+  TEST(TestStartAsyncSeesOtherThreadsDeclarations)
+  {
+    for (int i = 0; i < 50; i++)
+    {
+      Context context;
+      std::thread declarer([&context]()
+      {
+        context.has("baz", Instance<Baz>()).requires(Instance<Bar>(), &Baz::setBar);
+        context.has(Instance<Bar>());
+      });
+      declarer.join();
+
+      // the starter thread mustn't be the first to publish them
+      std::future<void> done = context.startAsync();
+      Baz* baz = NULL;
+      try { baz = context.waitFor(Instance<Baz>(), "baz"); } catch (DependencyInjectionException& e) {}
+      CHECK(baz != NULL && baz->bar != NULL);
+      done.get();
+      context.stop();
+    }
+  }
+}
+
+namespace prototypeTests
+{
+  class Bar
+  {
+  };
+
+  static std::atomic<int> buffersCreated(0);
+  static std::atomic<int> buffersDestroyed(0);
+
+  class Buffer
+  {
+  public:
+    Bar* bar;
+    int used;
+    bool postConstructed;
+
+    inline Buffer() : bar(nullptr), used(0), postConstructed(false) { buffersCreated++; }
+    inline ~Buffer() { buffersDestroyed++; }
+
+    void setBar(Bar* bar_) { bar = bar_; }
+    void postConstruct() { postConstructed = true; }
+    void clear() { used = 0; }
+  };
+
+  class Foo
+  {
+  public:
+    Buffer* buffer;
+    void setBuffer(Buffer* buffer_) { buffer = buffer_; }
+  };
+
+  TEST(TestPooledPrototype)
+  {
+    buffersCreated = 0;
+    buffersDestroyed = 0;
+
+    Context context;
+    context.has(Instance<Bar>());
+    context.has(Instance<Buffer>()).
+      requires(Instance<Bar>(), &Buffer::setBar).
+      postConstruct(&Buffer::postConstruct).
+      pooled(4, &Buffer::clear);
+    context.start();
+
+    CHECK(buffersCreated == 0);
+    CHECK(context.get(Instance<Buffer>()) == nullptr);
+
+    Buffer* first;
+    {
+      Lease<Buffer> buffer = context.acquire(Instance<Buffer>());
+      first = buffer.get();
+      CHECK(buffer->bar == context.get(Instance<Bar>()));
+      CHECK(buffer->postConstructed);
+      buffer->used = 10;
+
+      Lease<Buffer> other = context.acquire(Instance<Buffer>());
+      CHECK(other.get() != first);
+      CHECK(buffersCreated == 2);
+    }
+
+    // released instances are reset and reused
+    Lease<Buffer> again = context.acquire(Instance<Buffer>());
+    CHECK(buffersCreated == 2);
+    CHECK(again->used == 0);
+    again.release();
+
+    context.stop();
+    CHECK(buffersDestroyed == 2);
+  }
+
+  TEST(TestPoolNeverHoldsMoreThanMaxPooled)
+  {
+    buffersCreated = 0;
+    buffersDestroyed = 0;
+
+    Context context;
+    context.has(Instance<Buffer>()).pooled(3);
+    context.start();
+
+    // all released by one thread, which can still fill the pool.
+    {
+      std::vector<Lease<Buffer> > leases;
+      for (int i = 0; i < 20; i++)
+        leases.push_back(context.acquire(Instance<Buffer>()));
+    }
+    CHECK(buffersCreated == 20);
+    CHECK(buffersDestroyed == 17);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+      threads.push_back(std::thread([&context]() {
+        for (int n = 0; n < 50; n++)
+        {
+          std::vector<Lease<Buffer> > leases;
+          for (int i = 0; i < 5; i++)
+            leases.push_back(context.acquire(Instance<Buffer>()));
+        }
+      }));
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++)
+      it->join();
+    CHECK(buffersCreated - buffersDestroyed == 3);
+
+    context.stop();
+    CHECK(buffersCreated == buffersDestroyed);
+  }
+
+  TEST(TestUnpooledPrototype)
+  {
+    buffersCreated = 0;
+    buffersDestroyed = 0;
+
+    Context context;
+    context.has(Instance<Bar>());
+    context.has(Instance<Buffer>()).requires(Instance<Bar>(), &Buffer::setBar).prototype();
+    context.start();
+
+    context.acquire(Instance<Buffer>());
+    context.acquire(Instance<Buffer>());
+    CHECK(buffersCreated == 2);
+    CHECK(buffersDestroyed == 2);
+  }
+
+  TEST(TestPrototypeCannotBeInjected)
+  {
+    Context context;
+    context.has(Instance<Buffer>()).prototype();
+    context.has(Instance<Foo>()).requires(Instance<Buffer>(), &Foo::setBuffer);
+
+    bool failure = false;
+    try
+    {
+      context.start();
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+  }
+}
+
+namespace memoryReportTests
+{
+  class Bar
+  {
+    char data[1000];
+  };
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+    void setBar(Bar* bar_) { bar = bar_; }
+    void postConstruct() {}
+  };
+
+  TEST(TestMemoryReport)
+  {
+    Context context;
+    context.has(Instance<Foo>()).requires(Instance<Bar>(), &Foo::setBar);
+    context.has("bar",Instance<Bar>());
+
+    Context::MemoryReport before = context.memoryReport();
+    CHECK(before.beans == 2);
+    CHECK(before.instances == 0);
+    CHECK(before.instanceBytes == 0);
+    CHECK(before.metadataBytes > 0);
+    CHECK(before.registryBytes > 0);
+
+    context.start();
+    Context::MemoryReport after = context.memoryReport();
+    CHECK(after.instances == 2);
+    CHECK(after.instanceBytes == sizeof(Foo) + sizeof(Bar));
+    CHECK(after.metadataBytes == before.metadataBytes);
+  }
+
+  TEST(TestBeanLayout)
+  {
+    // the instance, the lifecycle methods and the pool on top of the BeanBase.
+    CHECK(sizeof(Bean<Foo>) <= sizeof(internal::BeanBase) + 3 * sizeof(void*));
+
+    // declaring lifecycle methods shows up in the metadata instead.
+    Context plain;
+    plain.has(Instance<Foo>());
+    Context withMethods;
+    withMethods.has(Instance<Foo>()).postConstruct(&Foo::postConstruct);
+    CHECK(withMethods.memoryReport().metadataBytes > plain.memoryReport().metadataBytes);
+  }
+}
+
+namespace internedIdTests
+{
+  class Bar {};
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+
+    inline Foo() : bar(NULL) {}
+    void setBar(Bar* bar_) { bar = bar_; }
+  };
+
+  TEST(TestIdsAreInterned)
+  {
+    std::string name("bar1");
+    CHECK(Id("bar1") == Id(name));
+    CHECK(Id("bar1") == DI_ID("bar1"));
+    CHECK(Id("bar1").symbol() == Id(name.c_str()).symbol());
+    CHECK(Id("bar1") != Id("bar2"));
+    CHECK(!Id().isSet());
+    CHECK(std::string(DI_ID("bar1").c_str()) == "bar1");
+  }
+
+  TEST(TestLookupById)
+  {
+    Context context;
+    context.has(Instance<Foo>()).requires(Instance<Bar>(DI_ID("bar2")), &Foo::setBar);
+    context.has(std::string("bar1"),Instance<Bar>());
+    context.has(Instance<Bar>("bar2"));
+    context.start();
+
+    Bar* bar1 = context.get(Instance<Bar>(),"bar1");
+    Bar* bar2 = context.get(Instance<Bar>(),DI_ID("bar2"));
+    CHECK(bar1 != NULL && bar2 != NULL && bar1 != bar2);
+    CHECK(context.get(Instance<Bar>(),Id(std::string("bar1"))) == bar1);
+    CHECK(context.get(Instance<Foo>())->bar == bar2);
+    CHECK(context.get(Instance<Bar>(),"bar3") == NULL);
+  }
+}
+
+namespace moduleTests
+{
+  class Bar {};
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+
+    inline Foo() : bar(NULL) {}
+    void setBar(Bar* bar_) { bar = bar_; }
+  };
+
+  static void declareFoo(Module& module)
+  {
+    module.has(Instance<Foo>()).requires(Instance<Bar>("bar1"), &Foo::setBar);
+  }
+
+  static void declareBars(Module& module)
+  {
+    module.has("bar1",Instance<Bar>());
+    module.has(Instance<Bar>("bar2"));
+  }
+
+  TEST(TestInstallModules)
+  {
+    Context context;
+    Module foos, bars(2);
+    declareFoo(foos);
+    declareBars(bars);
+    CHECK(bars.size() == 2);
+
+    context.install(foos);
+    context.install(bars);
+    CHECK(foos.empty() && bars.empty());
+    context.start();
+
+    Foo* foo = context.get(Instance<Foo>());
+    CHECK(foo != NULL);
+    CHECK(foo->bar == context.get(Instance<Bar>(),"bar1"));
+    CHECK(context.get(Instance<Bar>(),"bar2") != NULL);
+  }
+
+  TEST(TestDuplicateIdsInModule)
+  {
+    Context context;
+    context.has(Instance<Bar>("bar1"));
+
+    Module module;
+    module.has(Instance<Foo>());
+    module.has(Instance<Bar>("bar1"));
+
+    bool failure = false;
+    try
+    {
+      context.install(module);
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+    CHECK(module.size() == 2);
+    CHECK(context.find(Instance<Foo>()) == NULL);
+
+    Module same;
+    same.has(Instance<Bar>("bar2"));
+    same.has(Instance<Bar>("bar2"));
+    failure = false;
+    try
+    {
+      context.install(same);
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+
+    // the same id on different types isn't a duplicate
+    Module other;
+    other.has(Instance<Foo>("bar1"));
+    context.install(other);
+    CHECK(other.empty());
+  }
+}
+
+namespace adoptTests
+{
+  class Table
+  {
+  public:
+    bool postConstructed;
+    inline Table() : postConstructed(false) {}
+    void postConstruct() { postConstructed = true; }
+  };
+
+  class Reader
+  {
+  public:
+    Table* table;
+    inline Reader() : table(NULL) {}
+    void setTable(Table* table_) { table = table_; }
+  };
+
+  static int deleted = 0;
+  struct CountingDeleter { void operator()(Table* table) const { deleted++; delete table; } };
+
+  TEST(TestAdoptWithoutOwnership)
+  {
+    Table table;
+    {
+      Context context;
+      context.has(Instance<Table>(), &table).postConstruct(&Table::postConstruct);
+      context.has(Instance<Reader>()).requires(Instance<Table>(), &Reader::setTable);
+      context.start();
+      CHECK(context.get(Instance<Table>()) == &table);
+      CHECK(context.get(Instance<Reader>())->table == &table);
+      CHECK(table.postConstructed);
+    }
+    CHECK(table.postConstructed);
+  }
+
+  TEST(TestAdoptUniquePtr)
+  {
+    deleted = 0;
+    {
+      Context context;
+      std::unique_ptr<Table,CountingDeleter> table(new Table);
+      Table* raw = table.get();
+      context.has(Instance<Table>(), std::move(table));
+      context.start();
+      CHECK(context.get(Instance<Table>()) == raw);
+
+      // stopping doesn't give up the instance so the context can start again.
+      context.stop();
+      CHECK(deleted == 0);
+      context.start();
+      CHECK(context.get(Instance<Table>()) == raw);
+    }
+    CHECK(deleted == 1);
+  }
+
+  TEST(TestAdoptSharedPtr)
+  {
+    std::shared_ptr<Table> table(new Table);
+    {
+      Context context;
+      context.has(Instance<Table>("shared"), table);
+      CHECK(table.use_count() == 2);
+      context.start();
+      CHECK(context.get(Instance<Table>(), "shared") == table.get());
+    }
+    CHECK(table.use_count() == 1);
+  }
+
+  TEST(TestAdoptedCantBePrototype)
+  {
+    Table table;
+    Context context;
+    bool failure = false;
+    try
+    {
+      context.has(Instance<Table>(), &table).prototype();
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+
+    failure = false;
+    try
+    {
+      context.has(Instance<Table>(), (Table*)NULL);
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+  }
+}
+
+namespace providerTests
+{
+  class Bar
+  {
+  public:
+    static int created;
+    bool postConstructed;
+    inline Bar() : postConstructed(false) { created++; }
+    void postConstruct() { postConstructed = true; }
+  };
+  int Bar::created = 0;
+
+  class Buffer {};
+
+  class Foo
+  {
+  public:
+    Provider<Bar> bars;
+    Provider<Buffer> buffers;
+
+    void setBars(Provider<Bar> bars_) { bars = bars_; }
+    void setBuffers(const Provider<Buffer>& buffers_) { buffers = buffers_; }
+  };
+
+  class Baz
+  {
+  public:
+    Provider<Bar> bars;
+    inline Baz(Provider<Bar> bars_) : bars(bars_) {}
+  };
+
+  TEST(TestProviderSingleton)
+  {
+    Context context;
+    context.has(Instance<Foo>()).requires(Instance<Bar>(), &Foo::setBars);
+    context.has(Instance<Bar>());
+    context.start();
+
+    Foo* foo = context.get(Instance<Foo>());
+    CHECK(foo->bars.isResolved());
+    CHECK(foo->bars.get().get() == context.get(Instance<Bar>()));
+    CHECK(foo->bars.get().get() == foo->bars.get().get());
+  }
+
+  TEST(TestProviderLazy)
+  {
+    Bar::created = 0;
+    Context context;
+    context.has(Instance<Baz>(), Provider<Bar>());
+    context.has(Instance<Bar>()).lazy().postConstruct(&Bar::postConstruct);
+    context.start();
+    CHECK(Bar::created == 0);
+
+    Baz* baz = context.get(Instance<Baz>());
+    Bar* bar = baz->bars.get().get();
+    CHECK(bar != NULL);
+    CHECK(bar->postConstructed);
+    CHECK(Bar::created == 1);
+    CHECK(baz->bars.get().get() == bar);
+    CHECK(context.get(Instance<Bar>()) == bar);
+    CHECK(Bar::created == 1);
+
+    context.stop();
+    context.start();
+    CHECK(Bar::created == 1);
+    CHECK(context.get(Instance<Bar>()) != NULL);
+    CHECK(Bar::created == 2);
+  }
+
+  TEST(TestProviderPrototype)
+  {
+    Context context;
+    context.has(Instance<Foo>()).requires(Instance<Buffer>(), &Foo::setBuffers);
+    context.has(Instance<Buffer>()).pooled(1);
+    context.start();
+
+    Foo* foo = context.get(Instance<Foo>());
+    Lease<Buffer> first = foo->buffers.get();
+    Lease<Buffer> second = foo->buffers.get();
+    CHECK(first.get() != NULL && second.get() != NULL && first.get() != second.get());
+  }
+
+  TEST(TestLazyCantBeInjectedDirectly)
+  {
+    class User
+    {
+    public:
+      void setBar(Bar*) {}
+    };
+
+    Context context;
+    context.has(Instance<User>()).requires(Instance<Bar>(), &User::setBar);
+    context.has(Instance<Bar>()).lazy();
+
+    bool failure = false;
+    try
+    {
+      context.start();
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+  }
+}
+
+namespace statsTests
+{
+  class Bar {};
+  class Buffer {};
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+    inline Foo(Bar* bar_) : bar(bar_) {}
+  };
+
+  TEST(TestStats)
+  {
+    Context context;
+    context.has(Instance<Foo>(), Instance<Bar>());
+    context.has(Instance<Bar>());
+    context.has(Instance<Buffer>()).prototype();
+
+    // nothing is counted until stats are turned on.
+    context.get(Instance<Bar>());
+    Context::Stats stats = context.stats();
+    CHECK(!stats.enabled);
+    CHECK(stats.finds == 0);
+
+    context.enableStats();
+    context.start();
+    stats = context.stats();
+    CHECK(stats.enabled);
+    CHECK(stats.finds > 0);
+    CHECK(stats.conversions == 1);
+    CHECK(stats.declared == 3);
+    CHECK(stats.progress.instantiated == 3);
+
+    unsigned long long finds = stats.finds;
+    unsigned long long scanned = stats.candidatesScanned;
+    context.get(Instance<Foo>());
+    std::vector<internal::BeanBase*> all;
+    context.findAll(all, Instance<Bar>());
+    {
+      Lease<Buffer> buffer = context.acquire(Instance<Buffer>());
+    }
+
+    stats = context.stats();
+    CHECK(stats.finds == finds + 2); // get and acquire
+    CHECK(stats.findAlls >= 1);
+    CHECK(stats.candidatesScanned == scanned + 3);
+    CHECK(stats.acquired == 1);
+
+    context.enableStats(false);
+    context.get(Instance<Foo>());
+    CHECK(context.stats().finds == stats.finds);
+  }
+
+  class User
+  {
+  public:
+    Bar* bar;
+    std::vector<Bar*> bars;
+    inline User() : bar(NULL) {}
+    void setBar(Bar* b) { bar = b; }
+    void setBars(const std::vector<Bar*>& b) { bars = b; }
+  };
+
+  TEST(TestStatsCountInjectedConversions)
+  {
+    Context context;
+    context.has(Instance<User>()).requires(Instance<Bar>(), &User::setBar).requiresAll(Instance<Bar>(), &User::setBars);
+    context.has(Instance<Bar>());
+    context.enableStats();
+    context.start();
+    // one for requires and one for the one Bar requiresAll collects
+    CHECK(context.stats().conversions == 2);
+    context.stop();
+  }
+}
+
+namespace dependencyGraphTests
+{
+  class Base { public: virtual ~Base() {} };
+  class Bar : public Base {};
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+    inline Foo(Bar* bar_) : bar(bar_) {}
+  };
+
+  class Baz
+  {
+  public:
+    void setFoo(Foo*) {}
+    void setBases(std::vector<Base*>) {}
+    void setBars(Provider<Bar>) {}
+  };
+
+  TEST(TestDependencyGraph)
+  {
+    Context context;
+    context.has(Instance<Foo>(), Instance<Bar>());                   // 0
+    context.has(Instance<Bar>()).isAlso(Instance<Base>());           // 1
+    context.has(Instance<Baz>()).requires(Instance<Foo>(), &Baz::setFoo).
+      requiresAll(Instance<Base>(), &Baz::setBases).
+      requires(Instance<Bar>(), &Baz::setBars);                      // 2
+
+    Context::DependencyGraph graph = context.dependencyGraph();
+    CHECK(graph.nodes.size() == 3);
+    CHECK(graph.nodes[1].provides.size() == 2);
+    CHECK(graph.edges.size() == 4);
+
+    int kinds[4] = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < graph.edges.size(); i++)
+    {
+      kinds[graph.edges[i].kind]++;
+      CHECK(graph.edges[i].to != 2);
+    }
+    CHECK(kinds[Context::DependencyGraph::Edge::constructor] == 1);
+    CHECK(kinds[Context::DependencyGraph::Edge::setter] == 1);
+    CHECK(kinds[Context::DependencyGraph::Edge::all] == 1);
+    CHECK(kinds[Context::DependencyGraph::Edge::provider] == 1);
+
+    // Bar, then Foo, then Baz
+    graph.nodes[0].cost = std::chrono::nanoseconds(10);
+    graph.nodes[1].cost = std::chrono::nanoseconds(20);
+    graph.nodes[2].cost = std::chrono::nanoseconds(5);
+    graph.findCriticalPath();
+    CHECK(graph.criticalPath.size() == 3);
+    CHECK(graph.criticalPath[0] == 1 && graph.criticalPath[1] == 0 && graph.criticalPath[2] == 2);
+    CHECK(graph.criticalPathCost == std::chrono::nanoseconds(35));
+
+    std::string dot = graph.toDot();
+    CHECK(dot.find("n2 -> n0 [label=setter]") != std::string::npos);
+    std::string json = graph.toJson();
+    CHECK(json.find("\"criticalPath\":[1,0,2]") != std::string::npos);
+
+    context.start();
+    graph = context.dependencyGraph();
+    CHECK(graph.criticalPath.size() >= 1);
+  }
+
+  TEST(TestCriticalPathOfALongChain)
+  {
+    // far deeper than the stack would allow one call per node.
+    const size_t length = 1000000;
+    Context::DependencyGraph graph;
+    graph.nodes.resize(length);
+    for (size_t i = 0; i < length; i++)
+    {
+      graph.nodes[i].cost = std::chrono::nanoseconds(1);
+      if (i > 0)
+      {
+        Context::DependencyGraph::Edge edge;
+        edge.from = i - 1;
+        edge.to = i;
+        edge.kind = Context::DependencyGraph::Edge::setter;
+        graph.edges.push_back(edge);
+      }
+    }
+
+    graph.findCriticalPath();
+    CHECK(graph.criticalPath.size() == length);
+    CHECK(graph.criticalPath.front() == length - 1 && graph.criticalPath.back() == 0);
+    CHECK(graph.criticalPathCost == std::chrono::nanoseconds(length));
+  }
+}
+
+namespace statusTests
+{
+  class Bar {};
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+    inline Foo(Bar* bar_) : bar(bar_) {}
+  };
+
+  class Broken
+  {
+  public:
+    void postConstruct() { throw std::runtime_error("broken"); }
+  };
+
+  TEST(TestTryStart)
+  {
+    Context context;
+    context.has(Instance<Foo>(), Instance<Bar>("bar"));
+
+    Status status = context.tryStart();
+    CHECK(status.kind == Status::unsatisfied);
+    CHECK(status.bean == Instance<Foo>().toString());
+    CHECK(status.requirement == std::string("bar:") + Instance<Bar>().toString());
+    CHECK(!context.isStarted());
+
+    context.has("bar", Instance<Bar>());
+    CHECK(context.tryStart().isOk());
+    CHECK(context.tryStart().kind == Status::wrongPhase);
+    CHECK(context.tryStop().isOk());
+  }
+
+  TEST(TestTryStartCallbackFails)
+  {
+    Context context;
+    context.has(Instance<Broken>()).postConstruct(&Broken::postConstruct);
+
+    Status status = context.tryStart();
+    CHECK(status.kind == Status::callbackFailed);
+    CHECK(status.bean == Instance<Broken>().toString());
+  }
+
+  TEST(TestTryGet)
+  {
+    Context context;
+    context.has(Instance<Bar>());
+    context.has(Instance<Foo>(), Instance<Bar>()).lazy();
+
+    Bar* bar = NULL;
+    CHECK(context.tryGet(Instance<Bar>(), bar).kind == Status::wrongPhase);
+    CHECK(bar == NULL);
+
+    context.start();
+    CHECK(context.tryGet(Instance<Bar>(), bar).isOk());
+    CHECK(bar != NULL);
+
+    Foo* foo = NULL;
+    CHECK(context.tryGet(Instance<Foo>(), foo).isOk());
+    CHECK(foo != NULL && foo->bar == bar);
+
+    CHECK(context.tryGet(Instance<Bar>(), bar, "nope").kind == Status::notFound);
+    CHECK(bar == NULL);
+  }
+
+  TEST(TestTryInstall)
+  {
+    Context context;
+    context.has("bar", Instance<Bar>());
+
+    Module module;
+    module.has("bar", Instance<Bar>());
+    Status status = context.tryInstall(module);
+    CHECK(status.kind == Status::badDeclaration);
+    CHECK(status.bean == std::string("bar:") + Instance<Bar>().toString());
+    CHECK(!module.empty());
+  }
+}
+
+namespace scanTests
+{
+  class Base { public: virtual ~Base() {} };
+  class Foo : public Base {};
+  class Bar : public Base {};
+
+  static void checkLookups(Context& context, int count)
+  {
+    std::vector<internal::BeanBase*> found;
+    context.findAll(found, Instance<Foo>());
+    CHECK((int)found.size() == (count + 2) / 3);
+    found.clear();
+    context.findAll(found, Instance<Base>(), Id(), false);
+    CHECK((int)found.size() == count);
+
+    for (int i = 0; i < count; i++)
+    {
+      std::string id = std::to_string(i);
+      if (i % 3 == 0)
+      {
+        CHECK(context.find(Instance<Foo>(), id) != NULL);
+        CHECK(context.find(Instance<Bar>(), id) == NULL);
+      }
+      else
+      {
+        CHECK(context.find(Instance<Bar>(), id) != NULL);
+        CHECK(context.find(Instance<Foo>(), id) == NULL);
+      }
+      CHECK(context.find(Instance<Base>(), id, false) != NULL);
+    }
+    CHECK(context.find(Instance<Foo>(), "nope") == NULL);
+  }
+
+  TEST(TestScansAcrossManyBeans)
+  {
+    // enough that the scans go through a few SIMD widths and a remainder
+    const int count = 37;
+    Context context;
+    for (int i = 0; i < count; i++)
+    {
+      if (i % 3 == 0)
+        context.has(std::to_string(i), Instance<Foo>()).isAlso(Instance<Base>());
+      else
+        context.has(std::to_string(i), Instance<Bar>()).isAlso(Instance<Base>());
+    }
+
+    checkLookups(context, count);
+    context.start();
+    checkLookups(context, count);
+  }
+}
+
+namespace rootTests
+{
+  static int postConstructed = 0;
+
+  class Base { public: virtual ~Base() {} void postConstruct() { postConstructed++; } };
+  class Bar : public Base {};
+  class Baz : public Base {};
+  class Unused : public Base {};
+
+  class Foo : public Base
+  {
+  public:
+    Bar* bar;
+    std::vector<Baz*> bazes;
+    inline Foo(Bar* bar_) : bar(bar_) {}
+    void setBazes(std::vector<Baz*> b) { bazes = b; }
+  };
+
+  class Other : public Base
+  {
+  public:
+    Unused* unused;
+    inline Other(Unused* u) : unused(u) {}
+  };
+
+  TEST(TestOnlyWhatRootsNeedIsStarted)
+  {
+    postConstructed = 0;
+    Context context;
+    context.has(Instance<Foo>(), Instance<Bar>()).requiresAll(Instance<Baz>(), &Foo::setBazes).root().postConstruct(&Base::postConstruct);
+    context.has(Instance<Bar>()).postConstruct(&Base::postConstruct);
+    context.has("1", Instance<Baz>()).postConstruct(&Base::postConstruct);
+    context.has("2", Instance<Baz>()).postConstruct(&Base::postConstruct);
+    context.has(Instance<Other>(), Instance<Unused>()).postConstruct(&Base::postConstruct);
+    context.has(Instance<Unused>()).postConstruct(&Base::postConstruct);
+    context.start();
+
+    Foo* foo = context.get(Instance<Foo>());
+    CHECK(foo != NULL);
+    CHECK(foo->bar == context.get(Instance<Bar>()));
+    CHECK(foo->bazes.size() == 2);
+    CHECK(postConstructed == 4);
+
+    CHECK(context.get(Instance<Other>()) == NULL);
+    CHECK(context.get(Instance<Unused>()) == NULL);
+    CHECK(context.find(Instance<Unused>())->isDormant());
+    CHECK(!context.find(Instance<Bar>())->isDormant());
+
+    Context::Progress progress = context.progress();
+    CHECK(progress.instantiated == progress.total && progress.postConstructed == progress.total);
+
+    context.stop();
+  }
+}
+
+namespace replicaTests
+{
+  static int postConstructed = 0;
+
+  class Config {};
+
+  class Counter
+  {
+  public:
+    Config* config;
+    std::atomic<long> count;
+    inline Counter(Config* c) : config(c), count(0) {}
+    void postConstruct() { postConstructed++; }
+  };
+
+  class Requests
+  {
+  public:
+    Replicas<Counter> counters;
+    void setCounters(const Replicas<Counter>& c) { counters = c; }
+    long total() const { return counters.aggregate(0L, [](long sum, const Counter& c) { return sum + c.count.load(); }); }
+  };
+
+  class ByConstructor
+  {
+  public:
+    Replicas<Counter> counters;
+    inline ByConstructor(Replicas<Counter> c) : counters(c) {}
+  };
+
+  class Plain
+  {
+  public:
+    void setCounter(Counter*) {}
+  };
+
+  TEST(TestReplicasAreWiredAndAggregated)
+  {
+    postConstructed = 0;
+    Context context;
+    context.has(Instance<Config>());
+    context.has(Instance<Counter>(), Instance<Config>()).replicated(4).postConstruct(&Counter::postConstruct);
+    context.has(Instance<Requests>()).requires(Instance<Counter>(), &Requests::setCounters);
+    context.has(Instance<ByConstructor>(), Replicas<Counter>());
+    context.start();
+
+    Requests* requests = context.get(Instance<Requests>());
+    CHECK(requests->counters.isResolved());
+    CHECK(requests->counters.size() == 4);
+    CHECK(postConstructed == 4);
+    CHECK(context.get(Instance<ByConstructor>())->counters.local() == requests->counters.local());
+
+    for (unsigned int i = 0; i < requests->counters.size(); i++)
+    {
+      CHECK(requests->counters[i].config == context.get(Instance<Config>()));
+      CHECK(((std::uintptr_t)&requests->counters[i]) % 64 == 0);
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++)
+      threads.push_back(std::thread([requests]() {
+        for (int i = 0; i < 1000; i++)
+          requests->counters->count.fetch_add(1, std::memory_order_relaxed);
+      }));
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++)
+      it->join();
+
+    CHECK(requests->total() == 8000);
+    CHECK(context.get(Instance<Counter>()) == requests->counters.local());
+
+    context.stop();
+  }
+
+  TEST(TestReplicatedCannotBeInjectedDirectly)
+  {
+    Context context;
+    context.has(Instance<Config>());
+    context.has(Instance<Counter>(), Instance<Config>()).replicated(2);
+    context.has(Instance<Plain>()).requires(Instance<Counter>(), &Plain::setCounter);
+
+    Status status = context.tryStart();
+    CHECK(status.kind == Status::notInjectable);
+    CHECK(!context.isStarted());
+  }
+
+  TEST(TestReplicatedCannotBeLazy)
+  {
+    Context context;
+    bool failure = false;
+    try
+    {
+      context.has(Instance<Config>()).replicated().lazy();
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+  }
+}
+
+namespace decoratorTests
+{
+  static int calls = 0;
+  static std::vector<std::string> destroyed;
+
+  class IFoo
+  {
+  public:
+    virtual ~IFoo() {}
+    virtual int value() = 0;
+  };
+
+  class Foo : public IFoo
+  {
+  public:
+    ~Foo() { destroyed.push_back("Foo"); }
+    int value() { return 1; }
+  };
+
+  class Counting : public IFoo
+  {
+    IFoo* inner;
+  public:
+    inline Counting(IFoo* i) : inner(i) {}
+    ~Counting() { destroyed.push_back("Counting"); }
+    int value() { calls++; return inner->value(); }
+  };
+
+  class Doubling : public IFoo
+  {
+    IFoo* inner;
+  public:
+    inline Doubling(IFoo* i) : inner(i) {}
+    ~Doubling() { destroyed.push_back("Doubling"); }
+    int value() { return inner->value() * 2; }
+  };
+
+  class User
+  {
+  public:
+    IFoo* foo;
+    Foo* concrete;
+    inline User(IFoo* f) : foo(f), concrete(NULL) {}
+    void setConcrete(Foo* f) { concrete = f; }
+  };
+
+  class Users
+  {
+  public:
+    std::vector<IFoo*> foos;
+    Provider<IFoo> provided;
+    void setFoos(std::vector<IFoo*> f) { foos = f; }
+    void setProvided(const Provider<IFoo>& p) { provided = p; }
+  };
+
+  TEST(TestDecoratorsAreInjected)
+  {
+    calls = 0;
+    destroyed.clear();
+    Context context;
+    context.has(Instance<Foo>()).isAlso(Instance<IFoo>()).decorate<IFoo>(Instance<Counting>()).decorate<IFoo>(Instance<Doubling>());
+    context.has(Instance<User>(), Instance<IFoo>()).requires(Instance<Foo>(), &User::setConcrete);
+    context.has(Instance<Users>()).requiresAll(Instance<IFoo>(), &Users::setFoos).requires(Instance<IFoo>(), &Users::setProvided);
+    context.start();
+
+    User* user = context.get(Instance<User>());
+    CHECK(user->concrete == context.get(Instance<Foo>()));
+    CHECK(user->foo != (IFoo*)user->concrete);
+    CHECK(user->foo->value() == 2);
+    CHECK(calls == 1);
+
+    Users* users = context.get(Instance<Users>());
+    CHECK(users->foos.size() == 1 && users->foos[0] == user->foo);
+    CHECK(users->provided.get().get() == user->foo);
+
+    context.stop();
+    context.clear();
+    CHECK(destroyed.size() == 3);
+    if (destroyed.size() == 3)
+    {
+      CHECK(destroyed[0] == "Doubling");
+      CHECK(destroyed[1] == "Counting");
+      CHECK(destroyed[2] == "Foo");
+    }
+  }
+
+  TEST(TestCompileTimeDecorators)
+  {
+    calls = 0;
+    Context context;
+    context.has(Instance<Foo>()).decorate<IFoo,Counting,false>();
+    context.has(Instance<User>(), Instance<IFoo>());
+    context.start();
+
+    User* user = context.get(Instance<User>());
+    CHECK(user->foo == (IFoo*)context.get(Instance<Foo>()));
+    CHECK(!context.find(Instance<Foo>())->isDecorated());
+    context.stop();
+
+    Context traced;
+    traced.has(Instance<Foo>()).decorate<IFoo,Counting,true>();
+    traced.has(Instance<User>(), Instance<IFoo>());
+    traced.start();
+    CHECK(traced.get(Instance<User>())->foo->value() == 1);
+    CHECK(calls == 1);
+    traced.stop();
+  }
+}
+
+namespace swapTests
+{
+  static std::atomic<int> generations(0);
+  static std::atomic<int> preDestroyed(0);
+
+  class Config {};
+
+  class Routes
+  {
+  public:
+    Config* config;
+    int generation;
+    bool ready;
+    inline Routes(Config* c) : config(c), generation(++generations), ready(false) {}
+    void postConstruct() { ready = true; }
+    void preDestroy() { ready = false; preDestroyed++; }
+  };
+
+  class Router
+  {
+  public:
+    Swappable<Routes> routes;
+    void setRoutes(const Swappable<Routes>& r) { routes = r; }
+  };
+
+  class Plain
+  {
+  public:
+    void setRoutes(Routes*) {}
+  };
+
+  TEST(TestReplaceWhileReading)
+  {
+    generations = 0;
+    preDestroyed = 0;
+    Context context;
+    context.has(Instance<Config>());
+    context.has(Instance<Routes>(), Instance<Config>()).swappable().postConstruct(&Routes::postConstruct).preDestroy(&Routes::preDestroy);
+    context.has(Instance<Router>()).requires(Instance<Routes>(), &Router::setRoutes);
+    context.start();
+
+    Router* router = context.get(Instance<Router>());
+    CHECK(router->routes.isResolved());
+    CHECK(router->routes->generation == 1);
+
+    std::atomic<bool> done(false);
+    std::atomic<int> broken(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++)
+      readers.push_back(std::thread([router, &done, &broken]() {
+        int last = 0;
+        while (!done.load())
+        {
+          Swappable<Routes>::Ref routes = router->routes.get();
+          if (!routes->ready || routes->generation < last)
+            broken++;
+          last = routes->generation;
+        }
+      }));
+
+    for (int i = 0; i < 50; i++)
+      context.replace(Instance<Routes>());
+    done = true;
+    for (std::vector<std::thread>::iterator it = readers.begin(); it != readers.end(); it++)
+      it->join();
+
+    CHECK(broken == 0);
+    CHECK(router->routes->generation == 51);
+    CHECK(Swappable<Routes>::resolve(Instance<Routes>(), &context)->generation == 51);
+    CHECK(router->routes->config == context.get(Instance<Config>()));
+
+    context.stop();
+    CHECK(preDestroyed == 51);
+  }
+
+  TEST(TestReplacedIsDestroyedOnceReadersLeave)
+  {
+    generations = 0;
+    preDestroyed = 0;
+    Context context;
+    context.has(Instance<Config>());
+    context.has(Instance<Routes>(), Instance<Config>()).swappable().postConstruct(&Routes::postConstruct).preDestroy(&Routes::preDestroy);
+    context.has(Instance<Router>()).requires(Instance<Routes>(), &Router::setRoutes);
+    context.start();
+    Router* router = context.get(Instance<Router>());
+
+    // nobody is reading it so it goes right away.
+    context.replace(Instance<Routes>());
+    CHECK(preDestroyed == 1);
+
+    {
+      Swappable<Routes>::Ref held = router->routes.get();
+      std::thread([&context]() { context.replace(Instance<Routes>()); }).join();
+      CHECK(preDestroyed == 1);
+      CHECK(held->ready);
+      CHECK(held->generation == 2);
+
+      // readers that came after the replace don't hold it up.
+      Swappable<Routes>::Ref later = router->routes.get();
+      CHECK(later->generation == 3);
+    }
+    CHECK(preDestroyed == 2);
+    CHECK(router->routes->generation == 3);
+
+    context.stop();
+    CHECK(preDestroyed == 3);
+  }
+
+  TEST(TestSwappableMustBeInjectedAsSwappable)
+  {
+    Context context;
+    context.has(Instance<Config>());
+    context.has(Instance<Routes>(), Instance<Config>()).swappable();
+    context.has(Instance<Plain>()).requires(Instance<Routes>(), &Plain::setRoutes);
+
+    Status status = context.tryStart();
+    CHECK(status.kind == Status::notInjectable);
+  }
+
+  TEST(TestSwappableCantBeGotten)
+  {
+    Context context;
+    context.has(Instance<Config>());
+    context.has(Instance<Routes>(), Instance<Config>()).swappable();
+    context.start();
+
+    Routes* routes = NULL;
+    CHECK(context.tryGet(Instance<Routes>(), routes).kind == Status::notInjectable);
+    CHECK(routes == NULL);
+    CHECK(Swappable<Routes>::resolve(Instance<Routes>(), &context)->generation > 0);
+    context.stop();
+  }
+
+  TEST(TestReplaceNeedsSwappable)
+  {
+    Context context;
+    context.has(Instance<Config>());
+    context.start();
+    CHECK(context.tryReplace(Instance<Config>()).kind == Status::notFound);
+    context.stop();
+  }
+}
@@ -0,0 +1,742 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#include "../di.h"
+
+#include <UnitTest++/UnitTest++.h>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace di;
+
+namespace asyncStartTests
+{
+  class Bar
+  {
+  public:
+    bool calledPostConstruct;
+
+    inline Bar() : calledPostConstruct(false) {}
+    void postConstruct() { calledPostConstruct = true; }
+  };
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+
+    inline Foo() : bar(NULL) {}
+    void setBar(Bar* bar_) { bar = bar_; }
+  };
+
+  TEST(TestStartAsync)
+  {
+    Context context;
+    context.has(Instance<Foo>()).requires(Instance<Bar>(), &Foo::setBar);
+    context.has(Instance<Bar>()).postConstruct(&Bar::postConstruct);
+
+    std::future<void> done = context.startAsync();
+
+    Bar* bar = context.waitFor(Instance<Bar>());
+    CHECK(bar != NULL);
+    CHECK(bar->calledPostConstruct);
+
+    done.get();
+    CHECK(context.isStarted());
+
+    Context::Progress progress = context.progress();
+    CHECK(progress.total == 2);
+    CHECK(progress.instantiated == 2);
+    CHECK(progress.wired == 2);
+    CHECK(progress.postConstructed == 2);
+
+    Foo* foo = context.get(Instance<Foo>());
+    CHECK(foo != NULL);
+    CHECK(foo->bar == bar);
+
+    context.stop();
+    CHECK(context.isStopped());
+  }
+
+  class Unused {};
+  class Later {};
+
+  TEST(TestWaitForWhatStartWontCreate)
+  {
+    Context context;
+    context.has(Instance<Foo>()).requires(Instance<Bar>(), &Foo::setBar).root();
+    context.has(Instance<Bar>()).postConstruct(&Bar::postConstruct);
+    context.has(Instance<Unused>());
+    context.has(Instance<Later>()).lazy();
+
+    std::future<void> done = context.startAsync();
+
+    Unused* unused = NULL;
+    CHECK(context.tryWaitFor(Instance<Unused>(), unused).kind == Status::notCreated);
+    CHECK(unused == NULL);
+    Later* later = NULL;
+    CHECK(context.tryWaitFor(Instance<Later>(), later).kind == Status::notCreated);
+    Foo* foo = NULL;
+    CHECK(context.tryWaitFor(Instance<Foo>(), foo).isOk());
+    CHECK(foo != NULL && foo->bar != NULL);
+
+    done.get();
+    Context::Progress progress = context.progress();
+    CHECK(progress.total == 2);
+    CHECK(progress.instantiated == 2);
+    CHECK(progress.wired == 2);
+    CHECK(progress.postConstructed == 2);
+
+    // once started it's still not going to be created by the start.
+    CHECK(context.tryWaitFor(Instance<Unused>(), unused).kind == Status::notCreated);
+    context.stop();
+  }
+
+  TEST(TestStartAsyncFailure)
+  {
+    Context context;
+    context.has(Instance<Foo>()).requires(Instance<Bar>(), &Foo::setBar);
+
+    std::future<void> done = context.startAsync();
+
+    bool failure = false;
+    try
+    {
+      context.waitFor(Instance<Foo>());
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+
+    failure = false;
+    try
+    {
+      done.get();
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+    CHECK(!context.isStarted());
+  }
+
+  TEST(TestStopWaitsForStartAsync)
+  {
+    Context context;
+    context.has(Instance<Bar>()).postConstruct(&Bar::postConstruct);
+    context.startAsync();
+    context.stop();
+    CHECK(context.isStopped());
+  }
+
+  class Impatient
+  {
+  public:
+    static Context* context;
+    static Status stopped;
+    static Status waited;
+
+    void stopContext() { stopped = context->tryStop(); }
+    void waitForLater() { Later* later = NULL; waited = context->tryWaitFor(Instance<Later>(), later); }
+  };
+
+  Context* Impatient::context = NULL;
+  Status Impatient::stopped;
+  Status Impatient::waited;
+
+  TEST(TestCallbacksDontWaitForTheirOwnStart)
+  {
+    Context context;
+    Impatient::context = &context;
+    context.has(Instance<Impatient>()).postConstruct(&Impatient::waitForLater).warmUp(&Impatient::stopContext);
+    // postConstructed after Impatient
+    context.has(Instance<Later>());
+
+    // these would wait for the start that's running them
+    context.start();
+    CHECK(Impatient::stopped.kind == Status::wrongPhase);
+    CHECK(Impatient::waited.kind == Status::wrongPhase);
+    CHECK(context.isStarted());
+
+    Impatient::stopped = Status();
+    Impatient::waited = Status();
+    context.stop();
+    context.startAsync().get();
+    CHECK(Impatient::stopped.kind == Status::wrongPhase);
+    CHECK(Impatient::waited.kind == Status::wrongPhase);
+    context.stop();
+    CHECK(context.isStopped());
+  }
+}
+
+namespace warmUpTests
+{
+  class Cache
+  {
+  public:
+    bool postConstructed;
+    bool warmedUp;
+
+    inline Cache() : postConstructed(false), warmedUp(false) {}
+    void postConstruct() { postConstructed = true; }
+    void warmUp() { warmedUp = postConstructed; }
+  };
+
+  class SlowCache
+  {
+  public:
+    bool warmedUp;
+
+    inline SlowCache() : warmedUp(false) {}
+    void warmUp() 
+    { 
+      std::this_thread::sleep_for(std::chrono::milliseconds(50)); 
+      warmedUp = true;
+    }
+  };
+
+  TEST(TestWarmUp)
+  {
+    Context context;
+    context.has(Instance<Cache>()).postConstruct(&Cache::postConstruct).warmUp(&Cache::warmUp);
+    context.has(Instance<SlowCache>()).warmUp(&SlowCache::warmUp);
+    context.start();
+
+    CHECK(context.get(Instance<Cache>())->warmedUp);
+    CHECK(context.get(Instance<SlowCache>())->warmedUp);
+
+    const std::vector<Context::WarmUpResult>& report = context.warmUpReport();
+    CHECK(report.size() == 2);
+    for (size_t i = 0; i < report.size(); i++)
+      CHECK(report[i].status == Context::WarmUpResult::completed);
+    CHECK(context.progress().warmedUp == 2);
+  }
+
+  TEST(TestWarmUpBudget)
+  {
+    Context context;
+    context.setWarmUpBudget(std::chrono::milliseconds(1));
+    for (int i = 0; i < 64; i++)
+      context.has(Instance<SlowCache>()).warmUp(&SlowCache::warmUp);
+    context.start();
+
+    int skipped = 0;
+    const std::vector<Context::WarmUpResult>& report = context.warmUpReport();
+    for (size_t i = 0; i < report.size(); i++)
+      if (report[i].status == Context::WarmUpResult::skipped)
+        skipped++;
+    CHECK(skipped > 0);
+    CHECK(context.isStarted());
+  }
+
+  TEST(TestWarmUpCancelledByStop)
+  {
+    Context context;
+    for (int i = 0; i < 64; i++)
+      context.has(Instance<SlowCache>()).warmUp(&SlowCache::warmUp);
+    context.startAsync();
+    context.waitFor(Instance<SlowCache>());
+    context.stop();
+    CHECK(context.isStopped());
+  }
+
+  TEST(TestMultipleWarmUpRegistrations)
+  {
+    Context context;
+    bool failure = false;
+    try
+    {
+      context.has(Instance<Cache>()).warmUp(&Cache::warmUp).warmUp(&Cache::warmUp);
+    }
+    catch (di::DependencyInjectionException& ex)
+    {
+      failure = true;
+    }
+    CHECK(failure);
+  }
+}
+
+namespace startPlanTests
+{
+  class Bar {};
+
+  class Foo
+  {
+  public:
+    Bar* bar;
+    inline Foo(Bar* bar_) : bar(bar_) {}
+  };
+
+  class Baz
+  {
+  public:
+    Bar* bar;
+    inline Baz(Bar* bar_) : bar(bar_) {}
+  };
+
+  class Quick
+  {
+  public:
+    void warmUp() {}
+  };
+
+  class Slow
+  {
+  public:
+    void warmUp() { std::this_thread::sleep_for(std::chrono::milliseconds(20)); }
+  };
+
+  static const char* planFile = "TestStartPlan.diplan";
+
+  static void declare(Context& context)
+  {
+    context.setStartPlanFile(planFile);
+    context.has(Instance<Foo>(), Instance<Bar>());
+    context.has(Instance<Baz>(), Instance<Bar>());
+    context.has(Instance<Bar>());
+    context.has(Instance<Quick>()).warmUp(&Quick::warmUp);
+    context.has(Instance<Slow>()).warmUp(&Slow::warmUp);
+  }
+
+  TEST(TestStartPlan)
+  {
+    std::remove(planFile);
+    {
+      Context context;
+      declare(context);
+      context.start();
+      CHECK(!context.startedFromPlan());
+      CHECK(context.get(Instance<Foo>())->bar == context.get(Instance<Bar>()));
+      CHECK(context.get(Instance<Baz>())->bar == context.get(Instance<Bar>()));
+    }
+
+    {
+      Context context;
+      declare(context);
+      context.start();
+      CHECK(context.startedFromPlan());
+      CHECK(context.get(Instance<Foo>())->bar == context.get(Instance<Bar>()));
+      CHECK(context.get(Instance<Baz>())->bar == context.get(Instance<Bar>()));
+
+      // the slow warm up is started first this time.
+      const std::vector<Context::WarmUpResult>& report = context.warmUpReport();
+      CHECK(report.size() == 2);
+      CHECK(report[0].bean == Instance<Slow>().toString());
+    }
+
+    {
+      // different declarations ignore the plan.
+      Context context;
+      declare(context);
+      context.has(Instance<Quick>("another"));
+      context.start();
+      CHECK(!context.startedFromPlan());
+      CHECK(context.get(Instance<Foo>())->bar == context.get(Instance<Bar>()));
+    }
+    std::remove(planFile);
+  }
+
+  class Gate
+  {
+  public:
+    void warmUp() { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }
+  };
+
+  class Gated
+  {
+  public:
+    inline Gated(Gate*) {}
+    void warmUp() { std::this_thread::sleep_for(std::chrono::milliseconds(30)); }
+  };
+
+  class Medium
+  {
+  public:
+    void warmUp() { std::this_thread::sleep_for(std::chrono::milliseconds(10)); }
+  };
+
+  TEST(TestWarmUpCriticalPathFirst)
+  {
+    static const char* file = "TestWarmUpCriticalPathFirst.diplan";
+    std::remove(file);
+    for (int run = 0; run < 2; run++)
+    {
+      Context context;
+      context.setStartPlanFile(file);
+      context.has(Instance<Medium>()).warmUp(&Medium::warmUp);
+      context.has(Instance<Gated>(), Instance<Gate>()).warmUp(&Gated::warmUp);
+      context.has(Instance<Gate>()).warmUp(&Gate::warmUp);
+      context.start();
+
+      // the quick Gate goes first the second time since the slowest one depends on it.
+      const std::vector<Context::WarmUpResult>& report = context.warmUpReport();
+      CHECK(report.size() == 3);
+      if (run == 1 && report.size() == 3)
+      {
+        CHECK(report[0].bean == Instance<Gate>().toString());
+        CHECK(report[1].bean == Instance<Gated>().toString());
+      }
+    }
+    std::remove(file);
+  }
+}
+
+namespace exitTests
+{
+  static std::vector<std::string> events;
+
+  class Log
+  {
+  public:
+    ~Log() { events.push_back("~Log"); }
+    void flush() { events.push_back("flush"); }
+  };
+
+  class Cache
+  {
+  public:
+    ~Cache() { events.push_back("~Cache"); }
+    void preDestroy() { events.push_back("Cache::preDestroy"); }
+  };
+
+  class Writer
+  {
+  public:
+    Log* log;
+    Cache* cache;
+    inline Writer(Log* l, Cache* c) : log(l), cache(c) {}
+    ~Writer() { events.push_back("~Writer"); }
+    // the cache it uses is still there when it's preDestroyed
+    void close() { events.push_back(cache != NULL ? "close" : "close without cache"); }
+  };
+
+  // what stopForExit leaves (Cache and the context's book keeping here) is left 
+  //  for the process exit on purpose, so leak checkers (-fsanitize=address) report
+  //  it from these tests.
+  TEST(TestStopForExitOnlyCleansUpSideEffects)
+  {
+    events.clear();
+    {
+      Context context;
+      context.has(Instance<Log>()).sideEffects().preDestroy(&Log::flush);
+      context.has(Instance<Cache>()).preDestroy(&Cache::preDestroy);
+      context.has(Instance<Writer>(), Instance<Log>(), Instance<Cache>()).sideEffects().preDestroy(&Writer::close);
+      context.start();
+
+      context.stopForExit();
+      CHECK(context.isStopped());
+      CHECK(context.get(Instance<Log>()) == NULL);
+      CHECK(context.get(Instance<Cache>()) != NULL);
+      CHECK(context.tryStart().kind == Status::wrongPhase);
+    }
+
+    CHECK(events.size() == 4);
+    if (events.size() == 4)
+    {
+      CHECK(events[0] == "flush");
+      CHECK(events[1] == "close");
+      CHECK(events[2] == "~Log");
+      CHECK(events[3] == "~Writer");
+    }
+  }
+
+  TEST(TestStopForExitSeesSideEffectsDeclaredLate)
+  {
+    events.clear();
+    {
+      Context context;
+      Bean<Log>& log = context.has(Instance<Log>());
+      // the lookup adds it to the registry before the declaration is finished
+      CHECK(context.find(Instance<Log>()) != NULL);
+      log.sideEffects().preDestroy(&Log::flush);
+      context.start();
+      context.stopForExit();
+    }
+
+    CHECK(events.size() == 2);
+    if (events.size() == 2)
+    {
+      CHECK(events[0] == "flush");
+      CHECK(events[1] == "~Log");
+    }
+  }
+
+  class Failing
+  {
+  public:
+    void preDestroy() { events.push_back("fail"); throw std::runtime_error("failed"); }
+  };
+
+  TEST(TestStopForExitCleansUpPastAFailure)
+  {
+    events.clear();
+    {
+      Context context;
+      context.has(Instance<Failing>()).sideEffects().preDestroy(&Failing::preDestroy);
+      context.has(Instance<Log>()).sideEffects().preDestroy(&Log::flush);
+      context.start();
+
+      Status status = context.tryStopForExit();
+      CHECK(status.kind == Status::callbackFailed);
+      CHECK(status.bean == Instance<Failing>().toString());
+      CHECK(context.isStopped());
+      CHECK(context.get(Instance<Log>()) == NULL);
+      CHECK(context.tryStart().kind == Status::wrongPhase);
+    }
+
+    CHECK(events.size() == 3);
+    if (events.size() == 3)
+    {
+      CHECK(events[0] == "fail");
+      CHECK(events[1] == "flush");
+      CHECK(events[2] == "~Log");
+    }
+  }
+}
+
+namespace forkTests
+{
+  class Routes
+  {
+  public:
+    int postConstructed;
+    inline Routes() : postConstructed(0) {}
+    void postConstruct() { postConstructed++; }
+  };
+
+  class Listener
+  {
+  public:
+    Routes* routes;
+    int postConstructed;
+    inline Listener(Routes* r) : routes(r), postConstructed(0) {}
+    void postConstruct() { postConstructed++; }
+  };
+
+  class Worker
+  {
+  public:
+    Listener* listener;
+    Routes* routes;
+    inline Worker() : listener(NULL), routes(NULL) {}
+    void setListener(Listener* l) { listener = l; }
+    void setRoutes(Routes* r) { routes = r; }
+  };
+
+  TEST(TestOnForkedStartsWhatStartLeft)
+  {
+    Context context;
+    context.has(Instance<Routes>()).postConstruct(&Routes::postConstruct);
+    context.has(Instance<Listener>(), Instance<Routes>()).afterFork().postConstruct(&Listener::postConstruct);
+    context.has(Instance<Worker>()).requires(Instance<Listener>(), &Worker::setListener).requires(Instance<Routes>(), &Worker::setRoutes);
+
+    CHECK(context.tryOnForked().kind == Status::wrongPhase);
+    context.start();
+
+    // the Worker needs the Listener so it's left for onForked too.
+    Routes* routes = context.get(Instance<Routes>());
+    CHECK(routes != NULL && routes->postConstructed == 1);
+    CHECK(context.get(Instance<Listener>()) == NULL);
+    CHECK(context.get(Instance<Worker>()) == NULL);
+
+    context.onForked();
+    Listener* listener = context.get(Instance<Listener>());
+    Worker* worker = context.get(Instance<Worker>());
+    CHECK(context.get(Instance<Routes>()) == routes && routes->postConstructed == 1);
+    CHECK(listener != NULL && listener->routes == routes && listener->postConstructed == 1);
+    CHECK(worker != NULL && worker->listener == listener && worker->routes == routes);
+
+    context.stop();
+  }
+}
+
+namespace checkpointTests
+{
+  static int builds = 0;
+
+  class Index
+  {
+  public:
+    const int* entries;
+    size_t numEntries;
+    std::vector<int> built;
+
+    inline Index() : entries(NULL), numEntries(0) {}
+
+    void build()
+    {
+      builds++;
+      for (int i = 0; i < 100; i++)
+        built.push_back(i * i);
+      entries = &built[0];
+      numEntries = built.size();
+    }
+
+    void save(std::string& state) { state.append((const char*)entries, numEntries * sizeof(int)); }
+
+    // uses the checkpoint in place
+    bool restore(const char* data, size_t size)
+    {
+      if (size % sizeof(int) != 0)
+        return false;
+      entries = (const int*)data;
+      numEntries = size / sizeof(int);
+      return true;
+    }
+  };
+
+  static const char* checkpointFile = "TestCheckpoint.dichk";
+
+  TEST(TestCheckpointRestore)
+  {
+    std::remove(checkpointFile);
+    builds = 0;
+    {
+      Context context;
+      context.setCheckpointFile(checkpointFile);
+      context.has(Instance<Index>()).postConstruct(&Index::build).checkpointed(&Index::save, &Index::restore);
+      CHECK(context.tryCheckpoint(checkpointFile).kind == Status::wrongPhase);
+      context.start();
+      CHECK(builds == 1);
+      CHECK(context.instancesRestored() == 0);
+      context.checkpoint(checkpointFile);
+    }
+
+    {
+      Context context;
+      context.setCheckpointFile(checkpointFile);
+      context.has(Instance<Index>()).postConstruct(&Index::build).checkpointed(&Index::save, &Index::restore);
+      context.start();
+      CHECK(builds == 1);
+      CHECK(context.instancesRestored() == 1);
+      Index* index = context.get(Instance<Index>());
+      CHECK(index->built.size() == 0 && index->numEntries == 100 && index->entries[99] == 99 * 99);
+
+      // checkpointing over the file it restored from leaves what it's using alone.
+      context.checkpoint(checkpointFile);
+      CHECK(index->entries[99] == 99 * 99);
+    }
+
+    {
+      // a different declaration doesn't restore what another saved.
+      Context context;
+      context.setCheckpointFile(checkpointFile);
+      context.has(Instance<Index>("other")).postConstruct(&Index::build).checkpointed(&Index::save, &Index::restore);
+      context.start();
+      CHECK(builds == 2);
+      CHECK(context.instancesRestored() == 0);
+    }
+    std::remove(checkpointFile);
+  }
+
+  class Note
+  {
+  public:
+    std::string text;
+
+    void save(std::string& state) { state = text; }
+    bool restore(const char* data, size_t size) { text.assign(data, size); return true; }
+  };
+
+  class Notes
+  {
+  public:
+    std::vector<Note*> notes;
+    void setNotes(const std::vector<Note*>& notes_) { notes = notes_; }
+  };
+
+  static void declareNotes(Context& context)
+  {
+    context.setCheckpointFile(checkpointFile);
+    context.has(Instance<Note>()).checkpointed(&Note::save, &Note::restore);
+    context.has(Instance<Note>()).checkpointed(&Note::save, &Note::restore);
+    context.has(Instance<Notes>()).requiresAll(Instance<Note>(), &Notes::setNotes);
+  }
+
+  TEST(TestCheckpointSameDeclarationTwice)
+  {
+    std::remove(checkpointFile);
+    {
+      Context context;
+      declareNotes(context);
+      context.start();
+      Notes* notes = context.get(Instance<Notes>());
+      CHECK(notes->notes.size() == 2);
+      notes->notes[0]->text = "first";
+      notes->notes[1]->text = "second";
+      context.checkpoint(checkpointFile);
+    }
+
+    {
+      Context context;
+      declareNotes(context);
+      context.start();
+      CHECK(context.instancesRestored() == 2);
+      Notes* notes = context.get(Instance<Notes>());
+      CHECK(notes->notes.size() == 2);
+      CHECK(notes->notes[0]->text == "first");
+      CHECK(notes->notes[1]->text == "second");
+    }
+    std::remove(checkpointFile);
+  }
+}
+
+namespace compactTests
+{
+  static int destroyed = 0;
+
+  class Config
+  {
+  public:
+    std::string name;
+    inline Config(const std::string& name_) : name(name_) {}
+  };
+
+  class Service
+  {
+  public:
+    Config* config;
+    inline Service() : config(NULL) {}
+    ~Service() { destroyed++; }
+    void setConfig(Config* c) { config = c; }
+  };
+
+  class Cache
+  {
+  public:
+    Config* config;
+    inline Cache(Config* c) : config(c) {}
+  };
+
+  TEST(TestCompact)
+  {
+    destroyed = 0;
+    Context context;
+    context.has(Instance<Config>(), Constant<std::string>("a rather long name that the factory holds a copy of"));
+    context.has(Instance<Service>()).requires(Instance<Config>(), &Service::setConfig);
+    context.has(Instance<Cache>(), Instance<Config>()).lazy();
+
+    CHECK(context.tryCompact().kind == Status::wrongPhase);
+    context.start();
+    Service* service = context.get(Instance<Service>());
+    size_t before = context.memoryReport().metadataBytes;
+
+    context.compact();
+    CHECK(context.memoryReport().metadataBytes < before);
+    CHECK(context.get(Instance<Service>()) == service && service->config == context.get(Instance<Config>()));
+
+    // the lazy instance can still be created.
+    Cache* cache = context.get(Instance<Cache>());
+    CHECK(cache != NULL && cache->config == service->config);
+
+    context.stop();
+    CHECK(destroyed == 1);
+    CHECK(context.tryStart().kind == Status::wrongPhase);
+  }
+}
@@ -0,0 +1,13 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#include <UnitTest++/UnitTest++.h>
+
+#include <iostream>
+
+int main()
+{
+  return UnitTest::RunAllTests();
+}
+
@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2011
+ */
+
+#include "../../di.h"
+
+#include <UnitTest++/UnitTest++.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+
+using namespace di;
+
+/**
+ * Declares random graphs of instances, starts them and checks that what was
+ *  injected where is what a (much simpler) reference resolver says it should be.
+ *  The declaring, starting and looking up are done from many threads at once.
+ *
+ * DI_STRESS_ITERATIONS (default 200) is the number of graphs and DI_STRESS_SEED
+ *  the seed for the first one. A failure reports the seed of the graph it happened
+ *  on so it can be run again on it's own.
+ */
+namespace stressTests
+{
+  class Tagged
+  {
+  public:
+    virtual ~Tagged() {}
+  };
+
+  /**
+   * Every instance records what it was given.
+   */
+  class Node
+  {
+  public:
+    std::vector<Node*> constructedWith;
+    std::vector<Node*> setters;
+    std::vector<Tagged*> all;
+
+    virtual ~Node() {}
+    virtual Tagged* asTagged() = 0;
+
+    template<class D> void setDep(D* d) { setters.push_back(d); }
+    void setAll(const std::vector<Tagged*>& tagged) { all = tagged; }
+  };
+
+  /**
+   * C++ types have to exist at compile time so a graph is made of these. The
+   *  unnamed instances each have a Vertex of their own (0 to numUnnamed-1) since
+   *  they're found by type, the named ones are all a 'Named'.
+   */
+  template<int K> class Vertex : public Node, public Tagged
+  {
+  public:
+    inline Vertex() {}
+    inline Vertex(Node* a) { constructedWith.push_back(a); }
+    inline Vertex(Node* a, Node* b) { constructedWith.push_back(a); constructedWith.push_back(b); }
+    virtual Tagged* asTagged() { return this; }
+  };
+
+  static const int numUnnamed = 8;
+  static const int named = numUnnamed;
+  typedef Vertex<named> Named;
+
+  /**
+   * What's declared for one instance. A requirement on a named instance is either
+   *  by it's interface (Node) or by it's type (Named), 'byType'.
+   */
+  struct Spec
+  {
+    int kind; // the Vertex
+    std::string id; // empty when it's unnamed
+    Id name; // the same, interned once for the lookups
+    std::vector<int> constructedWith;
+    std::vector<bool> constructedByType;
+    std::vector<int> setters;
+    std::vector<bool> settersByType;
+    bool tagged; // isAlso(Tagged)
+    bool wantsAll; // requiresAll(Tagged)
+  };
+
+  struct Graph
+  {
+    std::vector<Spec> nodes;
+    bool cyclic; // the constructor dependencies have a cycle so it can't start
+    bool allUnsatisfied; // something requires all of the Tagged instances and there aren't any
+  };
+
+  static unsigned int envOr(const char* name, unsigned int otherwise)
+  {
+    const char* value = std::getenv(name);
+    return value != NULL ? (unsigned int)std::strtoul(value, NULL, 10) : otherwise;
+  }
+
+  //=======================================================================
+  // Generating a graph
+  //=======================================================================
+
+  // whether following the constructor dependencies from 'from' gets back to it
+  static bool reaches(const Graph& graph, int from, int to, std::vector<bool>& seen)
+  {
+    for (std::vector<int>::const_iterator it = graph.nodes[from].constructedWith.begin(); it != graph.nodes[from].constructedWith.end(); it++)
+    {
+      if (*it == to)
+        return true;
+      if (!seen[*it])
+      {
+        seen[*it] = true;
+        if (reaches(graph, *it, to, seen))
+          return true;
+      }
+    }
+    return false;
+  }
+
+  static Graph generate(std::mt19937& rng)
+  {
+    Graph graph;
+    std::uniform_int_distribution<int> percent(0, 99);
+    int numNamed = std::uniform_int_distribution<int>(1, 40)(rng);
+    int unnamed = std::uniform_int_distribution<int>(0, numUnnamed)(rng);
+    int count = numNamed + unnamed;
+
+    std::vector<int> kinds;
+    for (int i = 0; i < unnamed; i++)
+      kinds.push_back(i);
+    for (int i = 0; i < numNamed; i++)
+      kinds.push_back(named);
+    std::shuffle(kinds.begin(), kinds.end(), rng);
+
+    for (int i = 0; i < count; i++)
+    {
+      Spec spec;
+      spec.kind = kinds[i];
+      if (spec.kind == named)
+      {
+        char id[16];
+        snprintf(id, sizeof(id), "n%d", i);
+        spec.id = id;
+        spec.name = Id(id);
+      }
+      spec.tagged = percent(rng) < 50;
+      spec.wantsAll = percent(rng) < 15;
+      graph.nodes.push_back(spec);
+    }
+
+    // constructor dependencies only point at named instances that come earlier
+    //  in a random order, so there's no cycle yet.
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++)
+      order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    std::vector<int> namedSoFar;
+    for (int i = 0; i < count; i++)
+    {
+      Spec& spec = graph.nodes[order[i]];
+      int arity = namedSoFar.empty() ? 0 : std::uniform_int_distribution<int>(0, 2)(rng);
+      for (int a = 0; a < arity; a++)
+      {
+        spec.constructedWith.push_back(namedSoFar[std::uniform_int_distribution<size_t>(0, namedSoFar.size() - 1)(rng)]);
+        spec.constructedByType.push_back(percent(rng) < 50);
+      }
+      if (spec.kind == named)
+        namedSoFar.push_back(order[i]);
+    }
+
+    // setters can point anywhere, cycles (even to itself) included.
+    for (int i = 0; i < count; i++)
+    {
+      int numSetters = std::uniform_int_distribution<int>(0, 3)(rng);
+      for (int s = 0; s < numSetters; s++)
+      {
+        graph.nodes[i].setters.push_back(std::uniform_int_distribution<int>(0, count - 1)(rng));
+        graph.nodes[i].settersByType.push_back(percent(rng) < 50);
+      }
+    }
+
+    // sometimes close a cycle through the constructors.
+    graph.cyclic = false;
+    if (percent(rng) < 25)
+    {
+      for (int tries = 0; tries < 20 && !graph.cyclic; tries++)
+      {
+        int from = std::uniform_int_distribution<int>(0, count - 1)(rng);
+        int to = std::uniform_int_distribution<int>(0, count - 1)(rng);
+        Spec& spec = graph.nodes[from];
+        std::vector<bool> seen(count, false);
+        if (graph.nodes[to].kind == named && spec.constructedWith.size() < 2 && (from == to || reaches(graph, to, from, seen)))
+        {
+          spec.constructedWith.push_back(to);
+          spec.constructedByType.push_back(percent(rng) < 50);
+          graph.cyclic = true;
+        }
+      }
+    }
+    // requiresAll needs at least one.
+    bool anyTagged = false, anyWantsAll = false;
+    for (int i = 0; i < count; i++)
+    {
+      anyTagged = anyTagged || graph.nodes[i].tagged;
+      anyWantsAll = anyWantsAll || graph.nodes[i].wantsAll;
+    }
+    graph.allUnsatisfied = anyWantsAll && !anyTagged;
+    return graph;
+  }
+
+  //=======================================================================
+  // Declaring a graph
+  //=======================================================================
+
+  template<int K> static inline Instance<Vertex<K> > self(const Spec& spec)
+  {
+    return Instance<Vertex<K> >(spec.name);
+  }
+
+  template<int K> static Bean<Vertex<K> >& declareConstructor(Context& context, const Graph& graph, const Spec& spec)
+  {
+    if (spec.constructedWith.size() == 0)
+      return context.has(self<K>(spec));
+
+    const char* a = graph.nodes[spec.constructedWith[0]].id.c_str();
+    if (spec.constructedWith.size() == 1)
+      return spec.constructedByType[0] ? context.has(self<K>(spec), Instance<Named>(a)) : context.has(self<K>(spec), Instance<Node>(a));
+
+    const char* b = graph.nodes[spec.constructedWith[1]].id.c_str();
+    if (spec.constructedByType[0])
+      return spec.constructedByType[1] ? context.has(self<K>(spec), Instance<Named>(a), Instance<Named>(b)) :
+        context.has(self<K>(spec), Instance<Named>(a), Instance<Node>(b));
+    return spec.constructedByType[1] ? context.has(self<K>(spec), Instance<Node>(a), Instance<Named>(b)) :
+      context.has(self<K>(spec), Instance<Node>(a), Instance<Node>(b));
+  }
+
+  template<int K, int U> static inline void requireUnnamed(Bean<Vertex<K> >& bean)
+  {
+    bean.requires(Instance<Vertex<U> >(), &Node::setDep<Vertex<U> >);
+  }
+
+  template<int K> static void requireUnnamed(Bean<Vertex<K> >& bean, int kind)
+  {
+    switch (kind)
+    {
+      case 0: requireUnnamed<K,0>(bean); break;
+      case 1: requireUnnamed<K,1>(bean); break;
+      case 2: requireUnnamed<K,2>(bean); break;
+      case 3: requireUnnamed<K,3>(bean); break;
+      case 4: requireUnnamed<K,4>(bean); break;
+      case 5: requireUnnamed<K,5>(bean); break;
+      case 6: requireUnnamed<K,6>(bean); break;
+      case 7: requireUnnamed<K,7>(bean); break;
+    }
+  }
+
+  template<int K> static void declareVertex(Context& context, const Graph& graph, const Spec& spec)
+  {
+    Bean<Vertex<K> >& bean = declareConstructor<K>(context, graph, spec);
+    bean.isAlso(Instance<Node>());
+    if (spec.tagged)
+      bean.isAlso(Instance<Tagged>());
+
+    for (size_t s = 0; s < spec.setters.size(); s++)
+    {
+      const Spec& target = graph.nodes[spec.setters[s]];
+      if (target.kind != named)
+        requireUnnamed<K>(bean, target.kind);
+      else if (spec.settersByType[s])
+        bean.requires(Instance<Named>(target.id.c_str()), &Node::setDep<Named>);
+      else
+        bean.requires(Instance<Node>(target.id.c_str()), &Node::setDep<Node>);
+    }
+
+    if (spec.wantsAll)
+      bean.requiresAll(Instance<Tagged>(), &Node::setAll);
+  }
+
+  template<int K> static Node* getVertex(Context& context, const Spec& spec)
+  {
+    return context.get(Instance<Vertex<K> >(), spec.name);
+  }
+
+  template<int K> static Node* waitForVertex(Context& context, const Spec& spec)
+  {
+    return context.waitFor(Instance<Vertex<K> >(), spec.name);
+  }
+
+  typedef void (*Declarer)(Context&, const Graph&, const Spec&);
+  typedef Node* (*Getter)(Context&, const Spec&);
+
+  static const Declarer declarers[numUnnamed + 1] = { &declareVertex<0>, &declareVertex<1>, &declareVertex<2>, &declareVertex<3>,
+    &declareVertex<4>, &declareVertex<5>, &declareVertex<6>, &declareVertex<7>, &declareVertex<8> };
+  static const Getter getters[numUnnamed + 1] = { &getVertex<0>, &getVertex<1>, &getVertex<2>, &getVertex<3>,
+    &getVertex<4>, &getVertex<5>, &getVertex<6>, &getVertex<7>, &getVertex<8> };
+  static const Getter waiters[numUnnamed + 1] = { &waitForVertex<0>, &waitForVertex<1>, &waitForVertex<2>, &waitForVertex<3>,
+    &waitForVertex<4>, &waitForVertex<5>, &waitForVertex<6>, &waitForVertex<7>, &waitForVertex<8> };
+
+  /**
+   * Each thread declares every numThreads'th instance.
+   */
+  static void declareConcurrently(Context& context, const Graph& graph, unsigned int numThreads)
+  {
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numThreads; t++)
+      threads.push_back(std::thread([&context, &graph, numThreads, t]() {
+        for (size_t i = t; i < graph.nodes.size(); i += numThreads)
+          declarers[graph.nodes[i].kind](context, graph, graph.nodes[i]);
+      }));
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++)
+      it->join();
+  }
+
+  //=======================================================================
+  // Checking a graph
+  //=======================================================================
+
+  /**
+   * Compares what was injected with what the graph says should have been. Returns
+   *  the number of differences.
+   */
+  static int verify(Context& context, const Graph& graph)
+  {
+    int mismatches = 0;
+    std::vector<Node*> instances;
+    for (size_t i = 0; i < graph.nodes.size(); i++)
+    {
+      instances.push_back(getters[graph.nodes[i].kind](context, graph.nodes[i]));
+      if (instances.back() == NULL)
+        mismatches++;
+    }
+    if (mismatches > 0)
+      return mismatches;
+
+    std::multiset<Tagged*> tagged;
+    for (size_t i = 0; i < graph.nodes.size(); i++)
+      if (graph.nodes[i].tagged)
+        tagged.insert(instances[i]->asTagged());
+
+    for (size_t i = 0; i < graph.nodes.size(); i++)
+    {
+      const Spec& spec = graph.nodes[i];
+      Node* instance = instances[i];
+
+      std::vector<Node*> expected;
+      for (std::vector<int>::const_iterator it = spec.constructedWith.begin(); it != spec.constructedWith.end(); it++)
+        expected.push_back(instances[*it]);
+      if (instance->constructedWith != expected)
+        mismatches++;
+
+      expected.clear();
+      for (std::vector<int>::const_iterator it = spec.setters.begin(); it != spec.setters.end(); it++)
+        expected.push_back(instances[*it]);
+      if (instance->setters != expected)
+        mismatches++;
+
+      std::multiset<Tagged*> all(instance->all.begin(), instance->all.end());
+      if (all != (spec.wantsAll ? tagged : std::multiset<Tagged*>()))
+        mismatches++;
+    }
+
+    std::vector<internal::BeanBase*> found;
+    context.findAll(found, Instance<Tagged>(), Id(), false);
+    if (found.size() != tagged.size())
+      mismatches++;
+    return mismatches;
+  }
+
+  /**
+   * Looks up random instances from many threads at once while the context is
+   *  started. Every lookup has to find what 'verify' found.
+   */
+  static int lookUpConcurrently(Context& context, const Graph& graph, unsigned int numThreads, unsigned int seed)
+  {
+    std::vector<Node*> expected;
+    for (size_t i = 0; i < graph.nodes.size(); i++)
+      expected.push_back(getters[graph.nodes[i].kind](context, graph.nodes[i]));
+
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numThreads; t++)
+      threads.push_back(std::thread([&, t]() {
+        std::mt19937 rng(seed + t);
+        std::uniform_int_distribution<size_t> pick(0, graph.nodes.size() - 1);
+        for (int n = 0; n < 2000; n++)
+        {
+          size_t i = pick(rng);
+          const Spec& spec = graph.nodes[i];
+          if (getters[spec.kind](context, spec) != expected[i])
+            mismatches++;
+          if (spec.kind == named && context.get(Instance<Named>(), spec.name) != expected[i])
+            mismatches++;
+        }
+      }));
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++)
+      it->join();
+    return mismatches;
+  }
+
+  static int countInstantiated(Context& context, const Graph& graph)
+  {
+    int ret = 0;
+    for (size_t i = 0; i < graph.nodes.size(); i++)
+      if (getters[graph.nodes[i].kind](context, graph.nodes[i]) != NULL)
+        ret++;
+    return ret;
+  }
+
+  static unsigned int numThreads() { return std::max(4u, std::min(16u, std::thread::hardware_concurrency())); }
+
+  TEST(TestRandomGraphs)
+  {
+    unsigned int iterations = envOr("DI_STRESS_ITERATIONS", 200);
+    unsigned int firstSeed = envOr("DI_STRESS_SEED", (unsigned int)std::random_device()());
+    std::cout << "stress: " << iterations << " graphs from DI_STRESS_SEED=" << firstSeed << std::endl;
+
+    for (unsigned int seed = firstSeed; seed != firstSeed + iterations; seed++)
+    {
+      std::mt19937 rng(seed);
+      Graph graph = generate(rng);
+      Context context;
+      declareConcurrently(context, graph, numThreads());
+
+      if (graph.cyclic || graph.allUnsatisfied)
+      {
+        Status status = context.tryStart();
+        CHECK(status.kind == Status::unsatisfied);
+        CHECK_EQUAL(0, countInstantiated(context, graph));
+        if (status.kind != Status::unsatisfied)
+          std::cout << "stress: a graph that can't be satisfied started, DI_STRESS_SEED=" << seed << std::endl;
+        continue;
+      }
+
+      // the first start is asynchronous with threads waiting on random instances.
+      std::future<void> done = context.startAsync();
+      std::atomic<int> waitMismatches(0);
+      std::vector<Node*> waited(graph.nodes.size(), NULL);
+      std::vector<std::thread> waiters_;
+      for (unsigned int t = 0; t < numThreads(); t++)
+        waiters_.push_back(std::thread([&, t]() {
+          for (size_t i = t; i < graph.nodes.size(); i += numThreads())
+            waited[i] = waiters[graph.nodes[i].kind](context, graph.nodes[i]);
+        }));
+      for (std::vector<std::thread>::iterator it = waiters_.begin(); it != waiters_.end(); it++)
+        it->join();
+      done.get();
+      for (size_t i = 0; i < graph.nodes.size(); i++)
+        if (waited[i] != getters[graph.nodes[i].kind](context, graph.nodes[i]))
+          waitMismatches++;
+
+      int mismatches = waitMismatches + verify(context, graph) + lookUpConcurrently(context, graph, numThreads(), seed);
+      context.stop();
+      CHECK_EQUAL(0, countInstantiated(context, graph));
+
+      // and the same declarations start again, this time with a stop racing it.
+      std::future<void> again = context.startAsync();
+      std::thread stopper([&context]() { context.stop(); });
+      stopper.join();
+      again.get();
+      CHECK_EQUAL(0, countInstantiated(context, graph));
+
+      context.start();
+      mismatches += verify(context, graph);
+      CHECK_EQUAL(0, mismatches);
+      if (mismatches != 0)
+        std::cout << "stress: wrong wiring, DI_STRESS_SEED=" << seed << std::endl;
+    }
+  }
+}
@@ -0,0 +1,12 @@
+#!/bin/sh
+
+# The randomized stress tests. "./mk.sh tsan" and "./mk.sh asan" build them with
+#  ThreadSanitizer or AddressSanitizer. Run with DI_STRESS_ITERATIONS and 
+#  DI_STRESS_SEED set to control the graphs (see TestStressDi.cpp).
+case "$1" in
+  tsan) SANITIZE="-O1 -fsanitize=thread" ;;
+  asan) SANITIZE="-O1 -fsanitize=address -fno-omit-frame-pointer" ;;
+  *) SANITIZE="-O2" ;;
+esac
+
+g++ -std=c++11 -g -pthread $SANITIZE `pkg-config --cflags UnitTest++` -DDI_HEADER_ONLY *.cpp `pkg-config --libs UnitTest++` -o stress